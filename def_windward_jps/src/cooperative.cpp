@@ -0,0 +1,450 @@
+#include "cooperative.hpp"
+#include "tools.hpp"
+
+// Wait plus the eight moves; waiting costs the same as a straight step.
+static const Location COOPERATIVE_ACTIONS[9] = {
+    {0, 0},
+    {1, 0}, {-1, 0},
+    {0, -1}, {0, 1},
+    {1, 1}, {-1, 1},
+    {1, -1}, {-1, -1}
+};
+
+static int next_power_of_two(int value)
+{
+    int result = 16;
+    while(result < value) {
+        result *= 2;
+    }
+    return result;
+}
+
+static inline unsigned int hash_cell_time(int cell, int time)
+{
+    return (unsigned int)cell * 2654435761u ^ (unsigned int)time * 40503u;
+}
+
+ReservationTable::ReservationTable()
+    : entries(0)
+    , spare(0)
+    , capacity(0)
+    , count(0)
+{
+}
+
+ReservationTable::~ReservationTable()
+{
+    if(entries != 0) {
+        delete[] entries;
+        entries = 0;
+    }
+    if(spare != 0) {
+        delete[] spare;
+        spare = 0;
+    }
+    capacity = 0;
+    count = 0;
+}
+
+void ReservationTable::init(int max_reservations)
+{
+    int required = next_power_of_two(max_reservations * 2);
+    if(required != capacity) {
+        if(entries != 0) {
+            delete[] entries;
+        }
+        if(spare != 0) {
+            delete[] spare;
+        }
+        entries = new Entry[required];
+        spare = new Entry[required];
+        capacity = required;
+    }
+    clear();
+}
+
+void ReservationTable::clear()
+{
+    int i;
+    for(i = 0; i < capacity; ++i) {
+        entries[i].cell = -1;
+    }
+    count = 0;
+}
+
+int ReservationTable::slot(int cell, int time) const
+{
+    const int mask = capacity - 1;
+    int index = (int)(hash_cell_time(cell, time) & (unsigned int)mask);
+    while(entries[index].cell != -1) {
+        if(entries[index].cell == cell && entries[index].time == time) {
+            break;
+        }
+        index = (index + 1) & mask;
+    }
+    return index;
+}
+
+void ReservationTable::rebuild(int steps, int skip_agent)
+{
+    Entry* old_entries = entries;
+    entries = spare;
+    spare = old_entries;
+    clear();
+
+    int i;
+    for(i = 0; i < capacity; ++i) {
+        const Entry& entry = old_entries[i];
+        if(entry.cell != -1 && entry.time >= steps && entry.agent != skip_agent) {
+            reserve(entry.cell, entry.time - steps, entry.agent);
+        }
+    }
+}
+
+void ReservationTable::advance(int steps)
+{
+    if(steps <= 0 || count == 0) {
+        return;
+    }
+    rebuild(steps, -1);
+}
+
+void ReservationTable::release(int agent)
+{
+    if(count == 0) {
+        return;
+    }
+    // Linear probing cannot simply blank a slot, so rebuild, but only when
+    // the agent holds something.
+    int i;
+    for(i = 0; i < capacity; ++i) {
+        if(entries[i].cell != -1 && entries[i].agent == agent) {
+            rebuild(0, agent);
+            return;
+        }
+    }
+}
+
+bool ReservationTable::reserve(int cell, int time, int agent)
+{
+    if(capacity == 0) {
+        return false;
+    }
+    int index = slot(cell, time);
+    Entry& entry = entries[index];
+    if(entry.cell != -1) {
+        return entry.agent == agent;
+    }
+    if(count >= capacity / 2) {
+        return false;
+    }
+    entry.cell = cell;
+    entry.time = time;
+    entry.agent = agent;
+    count += 1;
+    return true;
+}
+
+int ReservationTable::reserved_by(int cell, int time) const
+{
+    if(count == 0) {
+        return -1;
+    }
+    const Entry& entry = entries[slot(cell, time)];
+    return entry.cell == -1 ? -1 : entry.agent;
+}
+
+CooperativePlanner::CooperativePlanner()
+    : window(0)
+    , nodes(0)
+    , node_count(0)
+    , max_nodes(0)
+    , node_index(0)
+    , index_capacity(0)
+    , open(0)
+    , open_size(0)
+    , open_capacity(0)
+{
+}
+
+CooperativePlanner::~CooperativePlanner()
+{
+    release();
+}
+
+void CooperativePlanner::release()
+{
+    if(nodes != 0) {
+        delete[] nodes;
+        nodes = 0;
+    }
+    if(node_index != 0) {
+        delete[] node_index;
+        node_index = 0;
+    }
+    if(open != 0) {
+        delete[] open;
+        open = 0;
+    }
+    node_count = 0;
+    max_nodes = 0;
+    index_capacity = 0;
+    open_size = 0;
+    open_capacity = 0;
+}
+
+void CooperativePlanner::init(int window_, int max_reservations, int max_nodes_)
+{
+    release();
+
+    window = window_;
+    reservations.init(max_reservations);
+
+    max_nodes = max_nodes_;
+    nodes = new Node[max_nodes];
+    index_capacity = next_power_of_two(max_nodes * 2);
+    node_index = new int[index_capacity];
+    int i;
+    for(i = 0; i < index_capacity; ++i) {
+        node_index[i] = -1;
+    }
+    open_capacity = max_nodes * 4;
+    open = new OpenEntry[open_capacity];
+}
+
+size_t CooperativePlanner::memory_bytes() const
+{
+    return reservations.memory_bytes()
+        + (size_t)max_nodes * sizeof(Node)
+        + (size_t)index_capacity * sizeof(int)
+        + (size_t)open_capacity * sizeof(OpenEntry);
+}
+
+int CooperativePlanner::find_node(const Location& loc, int time, int grid_width) const
+{
+    const int mask = index_capacity - 1;
+    const int cell = loc.y * grid_width + loc.x;
+    int index = (int)(hash_cell_time(cell, time) & (unsigned int)mask);
+    while(node_index[index] != -1) {
+        const Node& node = nodes[node_index[index]];
+        if(node.time == time && node.loc == loc) {
+            return node_index[index];
+        }
+        index = (index + 1) & mask;
+    }
+    return -1;
+}
+
+int CooperativePlanner::add_node(const Location& loc, int time, int parent, double cost, int grid_width)
+{
+    if(node_count >= max_nodes) {
+        return -1;
+    }
+
+    const int mask = index_capacity - 1;
+    const int cell = loc.y * grid_width + loc.x;
+    int index = (int)(hash_cell_time(cell, time) & (unsigned int)mask);
+    while(node_index[index] != -1) {
+        index = (index + 1) & mask;
+    }
+
+    Node& node = nodes[node_count];
+    node.loc = loc;
+    node.time = time;
+    node.parent = parent;
+    node.slot = index;
+    node.cost = cost;
+    node.closed = false;
+    node_index[index] = node_count;
+    return node_count++;
+}
+
+bool CooperativePlanner::open_push(double priority, int node)
+{
+    if(open_size >= open_capacity) {
+        return false;
+    }
+
+    int index = open_size++;
+    open[index].priority = priority;
+    open[index].node = node;
+    while(index > 0) {
+        int parent = (index - 1) / 2;
+        if(open[index].priority < open[parent].priority) {
+            OpenEntry temp = open[index];
+            open[index] = open[parent];
+            open[parent] = temp;
+            index = parent;
+        }
+        else {
+            break;
+        }
+    }
+    return true;
+}
+
+int CooperativePlanner::open_pop()
+{
+    int result = open[0].node;
+    open_size -= 1;
+    if(open_size > 0) {
+        open[0] = open[open_size];
+        int index = 0;
+        while(1) {
+            int left = index * 2 + 1;
+            int right = left + 1;
+            int smallest = index;
+            if(left < open_size && open[left].priority < open[smallest].priority) {
+                smallest = left;
+            }
+            if(right < open_size && open[right].priority < open[smallest].priority) {
+                smallest = right;
+            }
+            if(smallest == index) {
+                break;
+            }
+            OpenEntry temp = open[index];
+            open[index] = open[smallest];
+            open[smallest] = temp;
+            index = smallest;
+        }
+    }
+    return result;
+}
+
+bool CooperativePlanner::goal_free_until_window(const Grid& grid, const Location& goal, int from_time, int agent) const
+{
+    const int cell = grid.to_index(goal);
+    int t;
+    for(t = from_time + 1; t <= window; ++t) {
+        int holder = reservations.reserved_by(cell, t);
+        if(holder >= 0 && holder != agent) {
+            return false;
+        }
+    }
+    return true;
+}
+
+CooperativeResult CooperativePlanner::plan_agent(const Grid& grid, int agent,
+    const Location& start, const Location& goal, JpsPath* out_path)
+{
+    out_path->clear();
+    // A re-plan replaces the agent's previous reservations instead of
+    // stacking on them.
+    reservations.release(agent);
+    if(max_nodes == 0 || !grid.passable(start) || !grid.passable(goal)) {
+        return COOPERATIVE_FAILED;
+    }
+
+    const int width = grid.get_width();
+
+    // Forget the previous agent's nodes by clearing only the slots it used.
+    int i;
+    for(i = 0; i < node_count; ++i) {
+        node_index[nodes[i].slot] = -1;
+    }
+    node_count = 0;
+    open_size = 0;
+
+    int start_node = add_node(start, 0, -1, 0.0, width);
+    open_push(Tool::octile(start, goal), start_node);
+
+    int end_node = -1;
+    CooperativeResult result = COOPERATIVE_FAILED;
+
+    while(open_size > 0) {
+        int current = open_pop();
+        if(nodes[current].closed) {
+            continue;
+        }
+        nodes[current].closed = true;
+
+        const Location loc = nodes[current].loc;
+        const int time = nodes[current].time;
+        const double cost = nodes[current].cost;
+
+        if(loc == goal && goal_free_until_window(grid, goal, time, agent)) {
+            end_node = current;
+            result = COOPERATIVE_REACHED_GOAL;
+            break;
+        }
+        if(time >= window) {
+            // Beyond the window other agents are ignored; the octile estimate
+            // stands in for the rest of the route.
+            end_node = current;
+            result = COOPERATIVE_WINDOW_END;
+            break;
+        }
+
+        const int loc_cell = grid.to_index(loc);
+        int a;
+        for(a = 0; a < 9; ++a) {
+            const Location& dir = COOPERATIVE_ACTIONS[a];
+            const bool waiting = (dir.x == 0 && dir.y == 0);
+            if(!waiting && !grid.valid_move(loc, dir)) {
+                continue;
+            }
+
+            const Location next = loc + dir;
+            const int next_cell = grid.to_index(next);
+            int holder = reservations.reserved_by(next_cell, time + 1);
+            if(holder >= 0 && holder != agent) {
+                continue;
+            }
+            if(!waiting) {
+                // Two agents may not swap cells within one step.
+                int other = reservations.reserved_by(next_cell, time);
+                if(other >= 0 && other != agent && reservations.reserved_by(loc_cell, time + 1) == other) {
+                    continue;
+                }
+            }
+
+            const double step_cost = (dir.x != 0 && dir.y != 0) ? Tool::octile(loc, next) : 1.0;
+            const double next_cost = cost + step_cost;
+            int node = find_node(next, time + 1, width);
+            if(node >= 0) {
+                if(nodes[node].closed || next_cost >= nodes[node].cost) {
+                    continue;
+                }
+                nodes[node].cost = next_cost;
+                nodes[node].parent = current;
+            }
+            else {
+                node = add_node(next, time + 1, current, next_cost, width);
+                if(node < 0) {
+                    continue;
+                }
+            }
+            open_push(next_cost + Tool::octile(next, goal), node);
+        }
+    }
+
+    if(end_node < 0) {
+        return COOPERATIVE_FAILED;
+    }
+
+    const int end_time = nodes[end_node].time;
+    const int hold_steps = (result == COOPERATIVE_REACHED_GOAL) ? window - end_time : 0;
+    if(reservations.size() + end_time + 1 + hold_steps > reservations.max_size()) {
+        return COOPERATIVE_FAILED;
+    }
+    if(!out_path->reserve(end_time + 1)) {
+        return COOPERATIVE_FAILED;
+    }
+
+    int node = end_node;
+    while(node >= 0) {
+        out_path->points[nodes[node].time] = nodes[node].loc;
+        node = nodes[node].parent;
+    }
+    out_path->size = end_time + 1;
+
+    for(i = 0; i <= end_time; ++i) {
+        reservations.reserve(grid.to_index(out_path->points[i]), i, agent);
+    }
+    for(i = end_time + 1; i <= end_time + hold_steps; ++i) {
+        reservations.reserve(grid.to_index(goal), i, agent);
+    }
+
+    return result;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "grid.hpp"
+#include "jps.hpp"
+
+// Space-time reservation table: which agent occupies a cell at a time step.
+// Open-addressed hash with a fixed capacity, so memory stays bounded no
+// matter how many agents or how long the planning window is.
+class ReservationTable
+{
+private:
+    struct Entry
+    {
+        int cell;
+        int time;
+        int agent;
+    };
+
+    Entry* entries;
+    // Second buffer of the same capacity; advance() and release() rebuild
+    // into it and swap, so neither allocates.
+    Entry* spare;
+    int capacity;
+    int count;
+
+    int slot(int cell, int time) const;
+    // Re-inserts the entries at or after `steps`, shifted back by `steps`,
+    // except those held by `skip_agent`.
+    void rebuild(int steps, int skip_agent);
+
+    // Disable copying
+    ReservationTable(const ReservationTable&);
+    ReservationTable& operator=(const ReservationTable&);
+
+public:
+    ReservationTable();
+    ~ReservationTable();
+
+    // Capacity is rounded up to a power of two; at most half of it is used.
+    void init(int max_reservations);
+    void clear();
+    // Drops reservations before `steps` and shifts the remaining ones back.
+    void advance(int steps);
+    // Drops every reservation held by the agent.
+    void release(int agent);
+
+    // Returns false when the table is full or the slot is held by another agent.
+    bool reserve(int cell, int time, int agent);
+    // Agent holding the cell at the given time, or -1.
+    int reserved_by(int cell, int time) const;
+
+    int size() const { return count; }
+    int max_size() const { return capacity / 2; }
+    size_t memory_bytes() const { return (size_t)capacity * 2 * sizeof(Entry); }
+};
+
+enum CooperativeResult
+{
+    COOPERATIVE_FAILED = 0,
+    // The goal was reached inside the window and is held until the window ends.
+    COOPERATIVE_REACHED_GOAL,
+    // The window ended first; the path stops at the most promising cell.
+    COOPERATIVE_WINDOW_END
+};
+
+// Windowed cooperative A*. Agents are planned one at a time in priority order
+// through (cell, time) space; each plan avoids the cells and swaps reserved
+// by other agents, then reserves its own cells. The heuristic is octile
+// distance, not the true distance of hierarchical variants, so agents can
+// be led into dead ends that walls hide from the estimate.
+class CooperativePlanner
+{
+private:
+    struct Node
+    {
+        Location loc;
+        int time;
+        int parent;
+        int slot;
+        double cost;
+        bool closed;
+    };
+
+    struct OpenEntry
+    {
+        double priority;
+        int node;
+    };
+
+    ReservationTable reservations;
+    int window;
+
+    // Per-agent search state, allocated once at init and reused.
+    Node* nodes;
+    int node_count;
+    int max_nodes;
+    int* node_index;
+    int index_capacity;
+    OpenEntry* open;
+    int open_size;
+    int open_capacity;
+
+    int find_node(const Location& loc, int time, int grid_width) const;
+    int add_node(const Location& loc, int time, int parent, double cost, int grid_width);
+    bool open_push(double priority, int node);
+    int open_pop();
+    bool goal_free_until_window(const Grid& grid, const Location& goal, int from_time, int agent) const;
+
+    void release();
+
+    // Disable copying
+    CooperativePlanner(const CooperativePlanner&);
+    CooperativePlanner& operator=(const CooperativePlanner&);
+
+public:
+    CooperativePlanner();
+    ~CooperativePlanner();
+
+    void init(int window_, int max_reservations, int max_nodes_);
+    void clear() { reservations.clear(); }
+    void advance(int steps) { reservations.advance(steps); }
+    void release(int agent) { reservations.release(agent); }
+
+    size_t memory_bytes() const;
+
+    // Plans one agent against the current reservations and, on success,
+    // reserves its cells. The agent's earlier reservations are released
+    // first, so re-planning replaces them. `agent` must be non-negative and
+    // stay the same for an agent across calls. The path holds one cell per
+    // time step, so repeated cells are waits.
+    CooperativeResult plan_agent(const Grid& grid, int agent,
+        const Location& start, const Location& goal, JpsPath* out_path);
+};
@@ -9,9 +9,13 @@
 // include JPS algorithm components
 #include "jps.hpp"
 #include "grid.hpp"
+#include "cooperative.hpp"
+#include "landmarks.hpp"
+#include "recorder.hpp"
 
 #include "tools.hpp"
 
+#include <limits.h>
 #include <string.h>
 #include <new>
 
@@ -51,135 +55,1481 @@ static void PushLocation(lua_State* L, const Location& loc)
     lua_rawseti(L, -2, 2);
 }
 
-// GridWrapper to hold Grid instance in Lua userdata
+// Reads an optional integer field of an options table
+static int ReadIntField(lua_State* L, int index, const char* name, int default_value)
+{
+    int value = default_value;
+    lua_getfield(L, index, name);
+    if(lua_isnumber(L, -1)) {
+        value = (int)lua_tointeger(L, -1);
+    }
+    lua_pop(L, 1);
+    return value;
+}
+
+// Walls and the tables derived from them, shared by every grid handle that
+// refers to them. Each handle and a registry entry hold one reference.
+struct SharedGrid
+{
+    Grid grid;
+    // ALT tables used by the "alt" heuristic, empty until computed or loaded
+    LandmarkTable landmarks;
+    // Engine used when find_path does not name one; chosen by calibrate
+    JpsEngine engine;
+    // Base of an overlay, kept alive while the overlay exists
+    SharedGrid* base;
+    int refs;
+    // Set by publish. Published walls are never edited again, so any number
+    // of handles can search them without copying.
+    bool read_only;
+    // Registry key while published
+    bool registered;
+    dmhash_t name;
+
+    // Every live grid, so memory_stats and trim can reach them
+    static SharedGrid* first;
+    SharedGrid* prev;
+    SharedGrid* next;
+
+    SharedGrid()
+        : engine(JPS_ENGINE_JPS)
+        , base(0)
+        , refs(0)
+        , read_only(false)
+        , registered(false)
+        , name(0)
+        , prev(0)
+        , next(first)
+    {
+        if(first != 0) {
+            first->prev = this;
+        }
+        first = this;
+    }
+
+    ~SharedGrid()
+    {
+        if(prev != 0) {
+            prev->next = next;
+        } else {
+            first = next;
+        }
+        if(next != 0) {
+            next->prev = prev;
+        }
+    }
+
+    size_t memory_bytes() const { return grid.memory_bytes() + landmarks.memory_bytes(); }
+
+private:
+    // Disable copying
+    SharedGrid(const SharedGrid&);
+    SharedGrid& operator=(const SharedGrid&);
+};
+
+SharedGrid* SharedGrid::first = 0;
+
+static SharedGrid* AcquireSharedGrid(SharedGrid* shared)
+{
+    ++shared->refs;
+    return shared;
+}
+
+static void ReleaseSharedGrid(SharedGrid* shared)
+{
+    if(--shared->refs > 0) {
+        return;
+    }
+    // The overlay reads through to its base until it is gone.
+    SharedGrid* base = shared->base;
+    delete shared;
+    if(base != 0) {
+        ReleaseSharedGrid(base);
+    }
+}
+
+static SharedGrid* FindPublishedGrid(dmhash_t name)
+{
+    SharedGrid* shared;
+    for(shared = SharedGrid::first; shared != 0; shared = shared->next) {
+        if(shared->registered && shared->name == name) {
+            return shared;
+        }
+    }
+    return 0;
+}
+
+// Lua handle to a shared grid, held in userdata
 struct GridWrapper
 {
-    Grid grid;
-    bool initialized;
+    SharedGrid* shared;
+    // Shortcuts into the shared data
+    Grid& grid;
+    LandmarkTable& landmarks;
+    bool initialized;
+
+    explicit GridWrapper(SharedGrid* shared_)
+        : shared(AcquireSharedGrid(shared_))
+        , grid(shared_->grid)
+        , landmarks(shared_->landmarks)
+        , initialized(false)
+    {
+    }
+
+    ~GridWrapper()
+    {
+        ReleaseSharedGrid(shared);
+    }
+};
+
+static const char* GRID_MT_NAME = "def_windward_jps.Grid";
+
+// Helper to check and retrieve GridWrapper from userdata
+static GridWrapper* CheckGridWrapper(lua_State* L, int index)
+{
+    void* ud = luaL_checkudata(L, index, GRID_MT_NAME);
+    luaL_argcheck(L, ud != 0, index, "Grid expected");
+    return (GridWrapper*)ud;
+}
+
+// Raises an error when the grid's walls were published and must not change
+static GridWrapper* CheckMutableGridWrapper(lua_State* L, int index)
+{
+    GridWrapper* wrapper = CheckGridWrapper(L, index);
+    if(wrapper->shared->read_only) {
+        luaL_error(L, "grid is published and read-only; use create_overlay for local edits");
+    }
+    return wrapper;
+}
+
+// Raises an error unless width x height is a non-empty grid that fits in an int
+static void CheckGridSize(lua_State* L, int width, int height)
+{
+    luaL_argcheck(L, width > 0, 1, "width must be positive");
+    luaL_argcheck(L, height > 0, 2, "height must be positive");
+    luaL_argcheck(L, width <= INT_MAX / height, 2, "grid is too large");
+}
+
+// Create a new Grid instance
+// Parameters: width, height, walls_table
+// Returns: userdata (Grid instance)
+static int CreateGrid(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    int width = luaL_checkinteger(L, 1);
+    int height = luaL_checkinteger(L, 2);
+    CheckGridSize(L, width, height);
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    // Allocate userdata for GridWrapper
+    GridWrapper* wrapper = (GridWrapper*)lua_newuserdata(L, sizeof(GridWrapper));
+    
+    // Placement new to call constructor (C++98 compatible)
+    new (wrapper) GridWrapper(new SharedGrid());
+
+    // Set metatable
+    luaL_getmetatable(L, GRID_MT_NAME);
+    lua_setmetatable(L, -2);
+
+    // Initialize grid
+    wrapper->grid.reset(width, height);
+
+    // Set walls from table
+    int walls_count = lua_objlen(L, 3);
+    for(int i = 1; i <= walls_count; ++i) {
+        lua_rawgeti(L, 3, i);
+        Location wall = ReadLocation(L, -1);
+        wrapper->grid.set_blocked(wall, true);
+        lua_pop(L, 1);
+    }
+
+    wrapper->initialized = true;
+    return 1;
+}
+
+// PathIterator holds the compact waypoint list and expands it cell by cell
+struct PathIteratorWrapper
+{
+    JpsPath waypoints;
+    PathCursor cursor;
+};
+
+static const char* PATH_ITERATOR_MT_NAME = "def_windward_jps.PathIterator";
+
+enum PathOutput
+{
+    PATH_OUTPUT_JUMP_POINTS,
+    PATH_OUTPUT_WAYPOINTS,
+    PATH_OUTPUT_ITERATOR
+};
+
+// Scratch path reused across queries; grows to the longest path returned so far
+static JpsPath g_path_scratch;
+
+// Query log written by start_recording, closed by stop_recording
+static QueryRecorder g_recorder;
+
+// "alt" selects octile raised by the grid's landmark tables
+static heuristic_fn* ReadHeuristic(lua_State* L, int index, bool* use_landmarks)
+{
+    heuristic_fn* heuristic = Tool::octile;
+    *use_landmarks = false;
+    if(lua_isstring(L, index)) {
+        const char* heuristic_name = lua_tostring(L, index);
+        if(strcmp(heuristic_name, "alt") == 0) {
+            *use_landmarks = true;
+        } else if(strcmp(heuristic_name, "manhattan") == 0) {
+            heuristic = Tool::manhattan;
+        } else if(strcmp(heuristic_name, "euclidean") == 0) {
+            heuristic = Tool::euclidean;
+        } else if(strcmp(heuristic_name, "octile") == 0) {
+            heuristic = Tool::octile;
+        }
+    }
+    return heuristic;
+}
+
+static const char* ENGINE_NAMES[JPS_ENGINE_COUNT] = {"jps", "astar", "dijkstra"};
+
+// Returns the engine with the given name, or JPS_ENGINE_COUNT when unknown
+static JpsEngine FindEngine(const char* name)
+{
+    int i;
+    for(i = 0; i < JPS_ENGINE_COUNT; ++i) {
+        if(strcmp(name, ENGINE_NAMES[i]) == 0) {
+            return (JpsEngine)i;
+        }
+    }
+    return JPS_ENGINE_COUNT;
+}
+
+// Per-query settings read from the optional options table of find_path
+struct QueryOptions
+{
+    // JPS_ENGINE_COUNT selects the grid's default engine
+    JpsEngine engine;
+    PathOutput output;
+    bool smooth;
+    int clearance;
+    double epsilon;
+    bool focal;
+    double max_cost;
+    int max_radius;
+    int max_expansions;
+
+    QueryOptions()
+        : engine(JPS_ENGINE_COUNT)
+        , output(PATH_OUTPUT_JUMP_POINTS)
+        , smooth(false)
+        , clearance(1)
+        , epsilon(0.0)
+        , focal(false)
+        , max_cost(0.0)
+        , max_radius(0)
+        , max_expansions(0)
+    {
+    }
+};
+
+static void ReadQueryOptions(lua_State* L, int options_index, QueryOptions* options)
+{
+    lua_getfield(L, options_index, "engine");
+    if(lua_isstring(L, -1)) {
+        const char* engine_name = lua_tostring(L, -1);
+        options->engine = FindEngine(engine_name);
+        if(options->engine == JPS_ENGINE_COUNT) {
+            luaL_error(L, "unknown engine '%s'", engine_name);
+        }
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, options_index, "output");
+    if(lua_isstring(L, -1)) {
+        const char* output_name = lua_tostring(L, -1);
+        if(strcmp(output_name, "waypoints") == 0) {
+            options->output = PATH_OUTPUT_WAYPOINTS;
+        } else if(strcmp(output_name, "iterator") == 0) {
+            options->output = PATH_OUTPUT_ITERATOR;
+        } else if(strcmp(output_name, "jump_points") != 0) {
+            luaL_error(L, "unknown path output '%s'", output_name);
+        }
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, options_index, "smooth");
+    options->smooth = lua_toboolean(L, -1) != 0;
+    lua_pop(L, 1);
+
+    lua_getfield(L, options_index, "clearance");
+    if(lua_isnumber(L, -1)) {
+        options->clearance = (int)lua_tointeger(L, -1);
+        if(options->clearance < 1 || options->clearance > GRID_MAX_CLEARANCE) {
+            luaL_error(L, "clearance must be between 1 and %d", GRID_MAX_CLEARANCE);
+        }
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, options_index, "epsilon");
+    if(lua_isnumber(L, -1)) {
+        options->epsilon = lua_tonumber(L, -1);
+        if(options->epsilon < 0.0) {
+            luaL_error(L, "epsilon must not be negative");
+        }
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, options_index, "focal");
+    options->focal = lua_toboolean(L, -1) != 0;
+    lua_pop(L, 1);
+
+    lua_getfield(L, options_index, "max_cost");
+    if(lua_isnumber(L, -1)) {
+        options->max_cost = lua_tonumber(L, -1);
+        if(options->max_cost < 0.0) {
+            luaL_error(L, "max_cost must not be negative");
+        }
+    }
+    lua_pop(L, 1);
+
+    options->max_radius = ReadIntField(L, options_index, "max_radius", 0);
+    options->max_expansions = ReadIntField(L, options_index, "max_expansions", 0);
+    if(options->max_radius < 0 || options->max_expansions < 0) {
+        luaL_error(L, "max_radius and max_expansions must not be negative");
+    }
+}
+
+static const char* STATUS_NAMES[] = {"found", "no_path", "cost_limit", "radius_limit", "expansion_limit"};
+
+// Pushes the per-query info table, or nil when the caller passed no options
+static void PushQueryInfo(lua_State* L, const JpsStats& stats, bool requested)
+{
+    if(!requested) {
+        lua_pushnil(L);
+        return;
+    }
+
+    lua_createtable(L, 0, 7);
+    lua_pushstring(L, STATUS_NAMES[stats.status]);
+    lua_setfield(L, -2, "status");
+    lua_pushinteger(L, stats.expansions);
+    lua_setfield(L, -2, "expansions");
+    lua_pushnumber(L, stats.cost);
+    lua_setfield(L, -2, "cost");
+    lua_pushnumber(L, stats.suboptimality);
+    lua_setfield(L, -2, "suboptimality");
+    lua_pushinteger(L, stats.jump_cache_hits);
+    lua_setfield(L, -2, "jump_cache_hits");
+    lua_pushinteger(L, stats.jump_cache_misses);
+    lua_setfield(L, -2, "jump_cache_misses");
+    lua_pushinteger(L, stats.scanned_cells);
+    lua_setfield(L, -2, "scanned_cells");
+}
+
+static void PushPathTable(lua_State* L, const Location* points, int count)
+{
+    lua_createtable(L, count, 0);
+    int i;
+    for(i = 0; i < count; ++i) {
+        PushLocation(L, points[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+}
+
+static void PushPathIterator(lua_State* L, const Location* points, int count)
+{
+    PathIteratorWrapper* iterator = (PathIteratorWrapper*)lua_newuserdata(L, sizeof(PathIteratorWrapper));
+    new (iterator) PathIteratorWrapper();
+
+    luaL_getmetatable(L, PATH_ITERATOR_MT_NAME);
+    lua_setmetatable(L, -2);
+
+    iterator->waypoints.reserve(count);
+    int i;
+    for(i = 0; i < count; ++i) {
+        iterator->waypoints.points[i] = points[i];
+    }
+    iterator->waypoints.size = count;
+    iterator->cursor.reset(iterator->waypoints.points, count);
+}
+
+// Create a new chunked Grid for very large worlds
+// Parameters: width, height
+// Returns: userdata (Grid instance) with every chunk unloaded (blocked)
+static int CreateChunkedGrid(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    int width = luaL_checkinteger(L, 1);
+    int height = luaL_checkinteger(L, 2);
+    CheckGridSize(L, width, height);
+
+    GridWrapper* wrapper = (GridWrapper*)lua_newuserdata(L, sizeof(GridWrapper));
+    new (wrapper) GridWrapper(new SharedGrid());
+
+    luaL_getmetatable(L, GRID_MT_NAME);
+    lua_setmetatable(L, -2);
+
+    wrapper->grid.reset_chunked(width, height);
+    wrapper->initialized = true;
+    return 1;
+}
+
+// Streams in one chunk of a chunked grid
+// Parameters: self (Grid userdata), chunk_x, chunk_y (1-based),
+//             contents: "open", "blocked" or a walls table { {x, y}, ... } in grid coordinates
+static int LoadChunk(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 0);
+
+    GridWrapper* wrapper = CheckMutableGridWrapper(L, 1);
+    Grid& grid = wrapper->grid;
+    int cx = luaL_checkinteger(L, 2) - 1;
+    int cy = luaL_checkinteger(L, 3) - 1;
+    if(!grid.chunk_in_bounds(cx, cy)) {
+        return luaL_error(L, "chunk (%d, %d) is out of bounds or the grid is not chunked", cx + 1, cy + 1);
+    }
+
+    if(lua_type(L, 4) == LUA_TSTRING) {
+        const char* contents = lua_tostring(L, 4);
+        if(strcmp(contents, "open") == 0) {
+            grid.load_chunk(cx, cy, false);
+        } else if(strcmp(contents, "blocked") == 0) {
+            grid.load_chunk(cx, cy, true);
+        } else {
+            return luaL_error(L, "unknown chunk contents '%s'", contents);
+        }
+        return 0;
+    }
+
+    luaL_checktype(L, 4, LUA_TTABLE);
+    grid.load_chunk(cx, cy, false);
+
+    const int min_x = cx * GRID_CHUNK_SIZE;
+    const int min_y = cy * GRID_CHUNK_SIZE;
+    int walls_count = lua_objlen(L, 4);
+    for(int i = 1; i <= walls_count; ++i) {
+        lua_rawgeti(L, 4, i);
+        Location wall = ReadLocation(L, -1);
+        if(wall.x >= min_x && wall.x < min_x + GRID_CHUNK_SIZE
+            && wall.y >= min_y && wall.y < min_y + GRID_CHUNK_SIZE) {
+            grid.set_blocked(wall, true);
+        }
+        lua_pop(L, 1);
+    }
+    return 0;
+}
+
+// Drops a chunk's data; its cells read as blocked until it is loaded again
+// Parameters: self (Grid userdata), chunk_x, chunk_y (1-based)
+static int UnloadChunk(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 0);
+
+    GridWrapper* wrapper = CheckMutableGridWrapper(L, 1);
+    int cx = luaL_checkinteger(L, 2) - 1;
+    int cy = luaL_checkinteger(L, 3) - 1;
+    if(!wrapper->grid.chunk_in_bounds(cx, cy)) {
+        return luaL_error(L, "chunk (%d, %d) is out of bounds or the grid is not chunked", cx + 1, cy + 1);
+    }
+    wrapper->grid.unload_chunk(cx, cy);
+    return 0;
+}
+
+// Main pathfinding function exposed to Lua as method on Grid instance
+// Parameters: self (Grid userdata), start_table, goal_table, heuristic_name (optional), options (optional)
+// Options: output = "jump_points" (default) | "waypoints" | "iterator"
+//          smooth = true removes waypoints that have line of sight to each other
+//          clearance = k paths a k x k unit anchored at its top-left cell
+//          epsilon = e accepts paths up to (1 + e) times the optimum for fewer expansions
+//          focal = true uses a focal list for the epsilon bound instead of weighted priorities
+//          engine = "jps" | "astar" | "dijkstra" overrides the grid's calibrated engine
+//          max_cost, max_radius, max_expansions limit the search; when one is set and the
+//          goal is not reached, the path to the closest node found is returned
+// Returns: path table (or PathIterator) or nil plus error message, then a query info table
+//          ({status, expansions, cost, suboptimality, jump cache counters}) when options were passed
+static int FindPath(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 3);
+
+    // Get Grid instance from self (first parameter)
+    GridWrapper* wrapper = CheckGridWrapper(L, 1);
+    
+    if(!wrapper->initialized) {
+        lua_pushnil(L);
+        lua_pushstring(L, "grid not initialized");
+        lua_pushnil(L);
+        return 3;
+    }
+
+    luaL_checktype(L, 2, LUA_TTABLE);
+    Location start = ReadLocation(L, 2);
+
+    luaL_checktype(L, 3, LUA_TTABLE);
+    Location goal = ReadLocation(L, 3);
+
+    // The heuristic name may be omitted when an options table is passed
+    int options_index = 0;
+    heuristic_fn* heuristic = Tool::octile;
+    bool use_landmarks = false;
+    if(lua_gettop(L) >= 4) {
+        if(lua_istable(L, 4)) {
+            options_index = 4;
+        } else {
+            heuristic = ReadHeuristic(L, 4, &use_landmarks);
+            if(lua_gettop(L) >= 5 && lua_istable(L, 5)) {
+                options_index = 5;
+            }
+        }
+    }
+
+    QueryOptions options;
+    if(options_index != 0) {
+        ReadQueryOptions(L, options_index, &options);
+    }
+
+    Grid& grid = wrapper->grid;
+
+    if(options.clearance > 1 && !grid.supports_clearance()) {
+        lua_pushnil(L);
+        lua_pushstring(L, "clearance is not supported on chunked or overlay grids");
+        lua_pushnil(L);
+        return 3;
+    }
+
+    if(use_landmarks && !wrapper->landmarks.ready()) {
+        lua_pushnil(L);
+        lua_pushstring(L, "no landmark tables; call compute_landmarks or load_landmarks first");
+        lua_pushnil(L);
+        return 3;
+    }
+
+    JpsQuery query;
+    query.engine = (options.engine != JPS_ENGINE_COUNT) ? options.engine : wrapper->shared->engine;
+    query.heuristic = heuristic;
+    query.landmarks = use_landmarks ? &wrapper->landmarks : 0;
+    query.clearance = options.clearance;
+    query.epsilon = options.epsilon;
+    query.focal = options.focal;
+    query.max_cost = options.max_cost;
+    query.max_radius = options.max_radius;
+    query.max_expansions = options.max_expansions;
+    if(query.clearance > 1) {
+        grid.ensure_clearance();
+    }
+
+    if(!grid.in_bounds(start) || !grid.passable(start, query.clearance)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "start position is invalid or blocked");
+        lua_pushnil(L);
+        return 3;
+    }
+
+    if(!grid.in_bounds(goal) || !grid.passable(goal, query.clearance)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "goal position is invalid or blocked");
+        lua_pushnil(L);
+        return 3;
+    }
+
+    JpsStats stats;
+    int path_length;
+    if(g_recorder.is_open()) {
+        const uint64_t started = Tool::now_microseconds();
+        path_length = jps_find_path(grid, start, goal, query, &g_path_scratch, &stats);
+        const uint64_t elapsed = Tool::now_microseconds() - started;
+        g_recorder.record(grid, start, goal, query, path_length, stats, elapsed);
+    } else {
+        path_length = jps_find_path(grid, start, goal, query, &g_path_scratch, &stats);
+    }
+
+    if(path_length <= 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "no path found");
+        PushQueryInfo(L, stats, options_index != 0);
+        return 3;
+    }
+
+    if(options.smooth) {
+        path_length = jps_smooth_path(grid, g_path_scratch.points, path_length, query.clearance);
+    } else if(options.output != PATH_OUTPUT_JUMP_POINTS) {
+        path_length = jps_compact_path(g_path_scratch.points, path_length);
+    }
+
+    if(options.output == PATH_OUTPUT_ITERATOR) {
+        PushPathIterator(L, g_path_scratch.points, path_length);
+    } else {
+        PushPathTable(L, g_path_scratch.points, path_length);
+    }
+    // The scratch path falls under the memory budget too.
+    const size_t budget = jps_get_memory_budget();
+    if(budget > 0 && g_path_scratch.memory_bytes() > budget) {
+        g_path_scratch.release();
+    }
+    lua_pushnil(L);
+    PushQueryInfo(L, stats, options_index != 0);
+    return 3;
+}
+
+// Marks a single cell as blocked or open
+// Parameters: self (Grid userdata), position_table, blocked (boolean)
+static int SetBlocked(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 0);
+
+    GridWrapper* wrapper = CheckMutableGridWrapper(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    Location loc = ReadLocation(L, 2);
+    bool blocked = lua_toboolean(L, 3) != 0;
+    // Opening a wall can shorten distances, which would make the landmark
+    // bounds inadmissible; new walls only lengthen them.
+    if(!blocked && wrapper->landmarks.ready() && !wrapper->grid.passable(loc)) {
+        wrapper->landmarks.release();
+    }
+    wrapper->grid.set_blocked(loc, blocked);
+    return 0;
+}
+
+// Parameters: self (Grid userdata)
+// Returns: the grid version, which changes with every edit; pass it to validate_path
+static int GetVersion(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    GridWrapper* wrapper = CheckGridWrapper(L, 1);
+    lua_pushnumber(L, (lua_Number)wrapper->grid.get_version());
+    return 1;
+}
+
+// Reads the optional since_version and clearance arguments of validate_path(s)
+static void ReadValidateArgs(lua_State* L, GridWrapper* wrapper, int index, unsigned int* since_version, int* clearance)
+{
+    const lua_Number since = luaL_optnumber(L, index, 0);
+    luaL_argcheck(L, since >= 0, index, "version must not be negative");
+    *since_version = (unsigned int)since;
+    *clearance = (int)luaL_optinteger(L, index + 1, 1);
+    luaL_argcheck(L, *clearance >= 1 && *clearance <= GRID_MAX_CLEARANCE, index + 1, "clearance must be between 1 and 32");
+    if(*clearance > 1) {
+        if(!wrapper->grid.supports_clearance()) {
+            luaL_error(L, "clearance is not supported on chunked or overlay grids");
+        }
+        wrapper->grid.ensure_clearance();
+    }
+}
+
+// Reads a path argument: a PathIterator, whose waypoints are used in place,
+// or a path table { {x, y}, ... }, read into the scratch path
+static const Location* ReadPathArg(lua_State* L, int index, int* count)
+{
+    if(lua_type(L, index) == LUA_TUSERDATA && lua_getmetatable(L, index)) {
+        luaL_getmetatable(L, PATH_ITERATOR_MT_NAME);
+        const bool is_iterator = lua_rawequal(L, -1, -2) != 0;
+        lua_pop(L, 2);
+        if(is_iterator) {
+            const PathIteratorWrapper* iterator = (const PathIteratorWrapper*)lua_touserdata(L, index);
+            *count = iterator->waypoints.size;
+            return iterator->waypoints.points;
+        }
+    }
+
+    luaL_checktype(L, index, LUA_TTABLE);
+    *count = (int)lua_objlen(L, index);
+    if(!g_path_scratch.reserve(*count)) {
+        luaL_error(L, "out of memory");
+    }
+    int i;
+    for(i = 0; i < *count; ++i) {
+        lua_rawgeti(L, index, i + 1);
+        g_path_scratch.points[i] = ReadLocation(L, -1);
+        lua_pop(L, 1);
+    }
+    return g_path_scratch.points;
+}
+
+// Checks whether a path returned by find_path can still be walked after wall edits
+// Parameters: self (Grid userdata), path (table or PathIterator, whose waypoints are checked),
+//             since_version (optional; grid:version() when the path was found, so only
+//             segments near later edits are checked), clearance (optional, default 1)
+// Returns: index of the first blocked segment (segment i runs from path[i] to path[i + 1])
+//          or nil when the path is valid, then the current grid version
+static int ValidatePath(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 2);
+
+    GridWrapper* wrapper = CheckGridWrapper(L, 1);
+    unsigned int since_version;
+    int clearance;
+    ReadValidateArgs(L, wrapper, 3, &since_version, &clearance);
+    int count = 0;
+    const Location* path = ReadPathArg(L, 2, &count);
+
+    const int invalid = jps_validate_path(wrapper->grid, path, count, since_version, clearance);
+    if(invalid >= 0) {
+        lua_pushinteger(L, invalid + 1);
+    } else {
+        lua_pushnil(L);
+    }
+    lua_pushnumber(L, (lua_Number)wrapper->grid.get_version());
+    return 2;
+}
+
+// Batch form of validate_path
+// Parameters: self (Grid userdata), paths ({path, ...}), since_version (optional), clearance (optional)
+// Returns: table {[path index] = first blocked segment} listing only the invalid paths,
+//          then the current grid version
+static int ValidatePaths(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 2);
+
+    GridWrapper* wrapper = CheckGridWrapper(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    unsigned int since_version;
+    int clearance;
+    ReadValidateArgs(L, wrapper, 3, &since_version, &clearance);
+    const unsigned int version = wrapper->grid.get_version();
+
+    lua_newtable(L);
+    // Nothing changed: skip reading the paths at all.
+    if(since_version == 0 || since_version != version) {
+        const int path_count = (int)lua_objlen(L, 2);
+        int i;
+        for(i = 1; i <= path_count; ++i) {
+            lua_rawgeti(L, 2, i);
+            int count = 0;
+            const Location* path = ReadPathArg(L, lua_gettop(L), &count);
+            const int invalid = jps_validate_path(wrapper->grid, path, count, since_version, clearance);
+            lua_pop(L, 1);
+            if(invalid >= 0) {
+                lua_pushinteger(L, invalid + 1);
+                lua_rawseti(L, -2, i);
+            }
+        }
+    }
+    lua_pushnumber(L, (lua_Number)version);
+    return 2;
+}
+
+// Times every search engine on sample queries and makes the fastest one the
+// grid's default for find_path
+// Parameters: self (Grid userdata), options (optional):
+//             queries = 32 (at most 4096), radius limits the start-goal distance (0 = anywhere)
+// Returns: engine name, table {density, queries, jps, astar, dijkstra} with timings in microseconds
+static int Calibrate(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 2);
+
+    GridWrapper* wrapper = CheckGridWrapper(L, 1);
+    int queries = 32;
+    int radius = 0;
+    if(lua_gettop(L) >= 2 && lua_istable(L, 2)) {
+        queries = ReadIntField(L, 2, "queries", queries);
+        radius = ReadIntField(L, 2, "radius", radius);
+    }
+    luaL_argcheck(L, queries > 0, 2, "queries must be positive");
+    luaL_argcheck(L, radius >= 0, 2, "radius must not be negative");
+    if(queries > JPS_CALIBRATE_MAX_QUERIES) {
+        queries = JPS_CALIBRATE_MAX_QUERIES;
+    }
+
+    JpsCalibration calibration;
+    jps_calibrate(wrapper->grid, queries, radius, &calibration);
+    // Keep the current default when no sample query could be placed.
+    if(calibration.queries > 0) {
+        wrapper->shared->engine = calibration.best;
+    }
+
+    lua_pushstring(L, ENGINE_NAMES[wrapper->shared->engine]);
+    lua_createtable(L, 0, 2 + JPS_ENGINE_COUNT);
+    lua_pushnumber(L, calibration.density);
+    lua_setfield(L, -2, "density");
+    lua_pushinteger(L, calibration.queries);
+    lua_setfield(L, -2, "queries");
+    int i;
+    for(i = 0; i < JPS_ENGINE_COUNT; ++i) {
+        lua_pushnumber(L, (lua_Number)calibration.microseconds[i]);
+        lua_setfield(L, -2, ENGINE_NAMES[i]);
+    }
+    return 2;
+}
+
+// Creates a copy-on-write overlay sharing this grid's walls
+// Parameters: self (Grid userdata)
+// Returns: userdata (Grid instance); set_blocked on it leaves the base untouched
+static int CreateOverlay(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    GridWrapper* base = CheckGridWrapper(L, 1);
+
+    GridWrapper* wrapper = (GridWrapper*)lua_newuserdata(L, sizeof(GridWrapper));
+    new (wrapper) GridWrapper(new SharedGrid());
+
+    luaL_getmetatable(L, GRID_MT_NAME);
+    lua_setmetatable(L, -2);
+
+    wrapper->shared->base = AcquireSharedGrid(base->shared);
+    wrapper->grid.reset_overlay(&base->grid);
+    wrapper->initialized = true;
+    return 1;
+}
+
+// Drops every edit made on an overlay, revealing the base grid again
+// Parameters: self (Grid userdata)
+static int ClearOverlay(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 0);
+
+    GridWrapper* wrapper = CheckMutableGridWrapper(L, 1);
+    wrapper->grid.clear_overlay();
+    return 0;
+}
+
+// Parameters: self (Grid userdata), position_table
+// Returns: side of the largest square unit that fits with its top-left corner at the cell
+static int GetClearance(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    GridWrapper* wrapper = CheckGridWrapper(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    Location loc = ReadLocation(L, 2);
+    lua_pushinteger(L, wrapper->grid.clearance_at(loc));
+    return 1;
+}
+
+static PathIteratorWrapper* CheckPathIterator(lua_State* L, int index)
+{
+    void* ud = luaL_checkudata(L, index, PATH_ITERATOR_MT_NAME);
+    luaL_argcheck(L, ud != 0, index, "PathIterator expected");
+    return (PathIteratorWrapper*)ud;
+}
+
+// Expands the next cell steps of the path
+// Parameters: self (PathIterator userdata), max_cells
+// Returns: array of up to max_cells cells { {x, y}, ... }, empty once the goal was emitted
+static int PathIteratorNextCells(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    PathIteratorWrapper* iterator = CheckPathIterator(L, 1);
+    int max_cells = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, max_cells > 0, 2, "max_cells must be positive");
+
+    lua_createtable(L, max_cells < 64 ? max_cells : 64, 0);
+
+    Location cells[64];
+    int emitted = 0;
+    while(emitted < max_cells && !iterator->cursor.done()) {
+        int batch = max_cells - emitted;
+        if(batch > 64) {
+            batch = 64;
+        }
+        int written = iterator->cursor.next_cells(cells, batch);
+        int i;
+        for(i = 0; i < written; ++i) {
+            PushLocation(L, cells[i]);
+            lua_rawseti(L, -2, emitted + i + 1);
+        }
+        emitted += written;
+    }
+    return 1;
+}
+
+// Returns: true once every cell of the path has been emitted
+static int PathIteratorDone(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    PathIteratorWrapper* iterator = CheckPathIterator(L, 1);
+    lua_pushboolean(L, iterator->cursor.done());
+    return 1;
+}
+
+// Returns: the compact waypoint list backing the iterator
+static int PathIteratorWaypoints(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    PathIteratorWrapper* iterator = CheckPathIterator(L, 1);
+    PushPathTable(L, iterator->waypoints.points, iterator->waypoints.size);
+    return 1;
+}
+
+static int PathIteratorGC(lua_State* L)
+{
+    PathIteratorWrapper* iterator = (PathIteratorWrapper*)luaL_checkudata(L, 1, PATH_ITERATOR_MT_NAME);
+    if(iterator) {
+        iterator->PathIteratorWrapper::~PathIteratorWrapper();
+    }
+    return 0;
+}
+
+// CooperativePlanner keeps its grid alive through a registry reference
+struct PlannerWrapper
+{
+    CooperativePlanner planner;
+    GridWrapper* grid;
+    int grid_ref;
+
+    // Every live planner, so memory_stats can count them
+    static PlannerWrapper* first;
+    PlannerWrapper* prev;
+    PlannerWrapper* next;
+
+    PlannerWrapper()
+        : grid(0)
+        , grid_ref(LUA_NOREF)
+        , prev(0)
+        , next(first)
+    {
+        if(first != 0) {
+            first->prev = this;
+        }
+        first = this;
+    }
+
+    ~PlannerWrapper()
+    {
+        if(prev != 0) {
+            prev->next = next;
+        } else {
+            first = next;
+        }
+        if(next != 0) {
+            next->prev = prev;
+        }
+    }
 
-    GridWrapper() : initialized(false) {}
+private:
+    // Disable copying
+    PlannerWrapper(const PlannerWrapper&);
+    PlannerWrapper& operator=(const PlannerWrapper&);
 };
 
-static const char* GRID_MT_NAME = "def_windward_jps.Grid";
+PlannerWrapper* PlannerWrapper::first = 0;
 
-// Helper to check and retrieve GridWrapper from userdata
-static GridWrapper* CheckGridWrapper(lua_State* L, int index)
-{
-    void* ud = luaL_checkudata(L, index, GRID_MT_NAME);
-    luaL_argcheck(L, ud != 0, index, "Grid expected");
-    return (GridWrapper*)ud;
-}
+static const char* PLANNER_MT_NAME = "def_windward_jps.CooperativePlanner";
 
-// Create a new Grid instance
-// Parameters: width, height, walls_table
-// Returns: userdata (Grid instance)
-static int CreateGrid(lua_State* L)
+// Creates a windowed cooperative A* planner bound to this grid
+// Parameters: self (Grid userdata), options (optional):
+//             window = 16, max_reservations = 16384, max_nodes = 16384
+// Returns: CooperativePlanner userdata
+static int CreatePlanner(lua_State* L)
 {
     DM_LUA_STACK_CHECK(L, 1);
 
-    int width = luaL_checkinteger(L, 1);
-    int height = luaL_checkinteger(L, 2);
-    luaL_checktype(L, 3, LUA_TTABLE);
+    CheckGridWrapper(L, 1);
 
-    // Allocate userdata for GridWrapper
-    GridWrapper* wrapper = (GridWrapper*)lua_newuserdata(L, sizeof(GridWrapper));
-    
-    // Placement new to call constructor (C++98 compatible)
-    new (wrapper) GridWrapper();
+    int window = 16;
+    int max_reservations = 16384;
+    int max_nodes = 16384;
+    if(lua_gettop(L) >= 2 && lua_istable(L, 2)) {
+        window = ReadIntField(L, 2, "window", window);
+        max_reservations = ReadIntField(L, 2, "max_reservations", max_reservations);
+        max_nodes = ReadIntField(L, 2, "max_nodes", max_nodes);
+    }
+    luaL_argcheck(L, window > 0, 2, "window must be positive");
+    luaL_argcheck(L, max_reservations > 0, 2, "max_reservations must be positive");
+    luaL_argcheck(L, max_nodes > 0, 2, "max_nodes must be positive");
 
-    // Set metatable
-    luaL_getmetatable(L, GRID_MT_NAME);
+    PlannerWrapper* wrapper = (PlannerWrapper*)lua_newuserdata(L, sizeof(PlannerWrapper));
+    new (wrapper) PlannerWrapper();
+
+    luaL_getmetatable(L, PLANNER_MT_NAME);
     lua_setmetatable(L, -2);
 
-    // Initialize grid
-    wrapper->grid.reset(width, height);
+    lua_pushvalue(L, 1);
+    wrapper->grid_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    wrapper->grid = (GridWrapper*)lua_touserdata(L, 1);
+    wrapper->planner.init(window, max_reservations, max_nodes);
+    return 1;
+}
 
-    // Set walls from table
-    int walls_count = lua_objlen(L, 3);
-    for(int i = 1; i <= walls_count; ++i) {
-        lua_rawgeti(L, 3, i);
-        Location wall = ReadLocation(L, -1);
-        wrapper->grid.set_blocked(wall, true);
+static PlannerWrapper* CheckPlanner(lua_State* L, int index)
+{
+    void* ud = luaL_checkudata(L, index, PLANNER_MT_NAME);
+    luaL_argcheck(L, ud != 0, index, "CooperativePlanner expected");
+    return (PlannerWrapper*)ud;
+}
+
+// Plans agents in priority order, each avoiding the reservations of the others
+// Parameters: self (CooperativePlanner userdata),
+//             agents = { {start = {x, y}, goal = {x, y}, id = index}, ... } in priority order,
+//             options (optional): first = 1, budget_ms (per call time budget)
+// Returns: results keyed by agent index ({path = cells per time step, status = "goal" | "window"}
+//          or false), then the index to resume from when the budget ran out, or nil
+static int PlannerPlan(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 2);
+
+    PlannerWrapper* wrapper = CheckPlanner(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    int first = 1;
+    double budget_ms = -1.0;
+    if(lua_gettop(L) >= 3 && lua_istable(L, 3)) {
+        first = ReadIntField(L, 3, "first", first);
+        lua_getfield(L, 3, "budget_ms");
+        if(lua_isnumber(L, -1)) {
+            budget_ms = lua_tonumber(L, -1);
+        }
         lua_pop(L, 1);
     }
 
-    wrapper->initialized = true;
+    const Grid& grid = wrapper->grid->grid;
+    const uint64_t start_time = Tool::now_microseconds();
+    const int agent_count = (int)lua_objlen(L, 2);
+    int next = 0;
+
+    lua_newtable(L);
+    int i;
+    for(i = first; i <= agent_count; ++i) {
+        if(budget_ms >= 0.0 && i > first
+            && (double)(Tool::now_microseconds() - start_time) >= budget_ms * 1000.0) {
+            next = i;
+            break;
+        }
+
+        lua_rawgeti(L, 2, i);
+        luaL_checktype(L, -1, LUA_TTABLE);
+        lua_getfield(L, -1, "start");
+        luaL_checktype(L, -1, LUA_TTABLE);
+        Location start = ReadLocation(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, -1, "goal");
+        luaL_checktype(L, -1, LUA_TTABLE);
+        Location goal = ReadLocation(L, -1);
+        lua_pop(L, 1);
+        // Reservations are held per id, so an agent keeps its id when the list is reordered
+        const int id = ReadIntField(L, -1, "id", i);
+        luaL_argcheck(L, id >= 0, 2, "agent id must be non-negative");
+        lua_pop(L, 1);
+
+        CooperativeResult result = COOPERATIVE_FAILED;
+        if(wrapper->grid->initialized && grid.in_bounds(start) && grid.in_bounds(goal)) {
+            result = wrapper->planner.plan_agent(grid, id, start, goal, &g_path_scratch);
+        }
+        else {
+            wrapper->planner.release(id);
+        }
+
+        if(result == COOPERATIVE_FAILED) {
+            lua_pushboolean(L, 0);
+        } else {
+            lua_createtable(L, 0, 2);
+            PushPathTable(L, g_path_scratch.points, g_path_scratch.size);
+            lua_setfield(L, -2, "path");
+            lua_pushstring(L, result == COOPERATIVE_REACHED_GOAL ? "goal" : "window");
+            lua_setfield(L, -2, "status");
+        }
+        lua_rawseti(L, -2, i);
+    }
+
+    if(next > 0) {
+        lua_pushinteger(L, next);
+    } else {
+        lua_pushnil(L);
+    }
+    return 2;
+}
+
+// Drops every reservation
+static int PlannerClear(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 0);
+
+    CheckPlanner(L, 1)->planner.clear();
+    return 0;
+}
+
+// Drops the reservations held by one agent, e.g. when it leaves the map
+// Parameters: self (CooperativePlanner userdata), id
+static int PlannerRelease(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 0);
+
+    PlannerWrapper* wrapper = CheckPlanner(L, 1);
+    int id = luaL_checkinteger(L, 2);
+    wrapper->planner.release(id);
+    return 0;
+}
+
+// Moves the planner clock forward: reservations before `steps` are dropped
+// and the rest shift so time 0 is the current step again
+static int PlannerAdvance(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 0);
+
+    PlannerWrapper* wrapper = CheckPlanner(L, 1);
+    int steps = luaL_checkinteger(L, 2);
+    wrapper->planner.advance(steps);
+    return 0;
+}
+
+static int PlannerGC(lua_State* L)
+{
+    PlannerWrapper* wrapper = (PlannerWrapper*)luaL_checkudata(L, 1, PLANNER_MT_NAME);
+    if(wrapper) {
+        luaL_unref(L, LUA_REGISTRYINDEX, wrapper->grid_ref);
+        wrapper->PlannerWrapper::~PlannerWrapper();
+    }
+    return 0;
+}
+
+struct LandmarkWorker
+{
+    LandmarkTable* table;
+    const Grid* grid;
+    int first;
+    int stride;
+};
+
+static void LandmarkWorkerMain(void* arg)
+{
+    LandmarkWorker* worker = (LandmarkWorker*)arg;
+    int i;
+    for(i = worker->first; i < worker->table->get_count(); i += worker->stride) {
+        worker->table->compute(*worker->grid, i);
+    }
+}
+
+// Precomputes ALT landmark tables for the "alt" heuristic
+// Parameters: self (Grid userdata), options (optional):
+//             count = 8 (at most 32), max_bytes caps the table memory, threads = 4
+// Returns: number of landmarks computed
+static int ComputeLandmarks(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    GridWrapper* wrapper = CheckGridWrapper(L, 1);
+    int count = 8;
+    int max_bytes = 0;
+    int threads = 4;
+    if(lua_gettop(L) >= 2 && lua_istable(L, 2)) {
+        count = ReadIntField(L, 2, "count", count);
+        max_bytes = ReadIntField(L, 2, "max_bytes", max_bytes);
+        threads = ReadIntField(L, 2, "threads", threads);
+    }
+    luaL_argcheck(L, count > 0 && count <= LANDMARK_MAX_COUNT, 2, "count must be between 1 and 32");
+    luaL_argcheck(L, max_bytes >= 0, 2, "max_bytes must not be negative");
+    luaL_argcheck(L, threads > 0, 2, "threads must be positive");
+    if(!wrapper->grid.is_flat()) {
+        return luaL_error(L, "landmarks are not supported on chunked or overlay grids");
+    }
+
+    if(max_bytes > 0) {
+        const size_t row_bytes = (size_t)wrapper->grid.grid_size() * sizeof(unsigned short);
+        if(row_bytes > 0 && (size_t)max_bytes / row_bytes < (size_t)count) {
+            count = (int)((size_t)max_bytes / row_bytes);
+        }
+    }
+
+    LandmarkTable& table = wrapper->landmarks;
+    count = (count > 0) ? table.prepare(wrapper->grid, count) : 0;
+    if(threads > count) {
+        threads = count;
+    }
+
+    LandmarkWorker workers[LANDMARK_MAX_COUNT];
+    int i;
+    for(i = 0; i < threads; ++i) {
+        workers[i].table = &table;
+        workers[i].grid = &wrapper->grid;
+        workers[i].first = i;
+        workers[i].stride = threads;
+    }
+#if defined(__EMSCRIPTEN__)
+    // No threads on HTML5: run the workers one after another.
+    for(i = 0; i < threads; ++i) {
+        LandmarkWorkerMain(&workers[i]);
+    }
+#else
+    dmThread::Thread handles[LANDMARK_MAX_COUNT];
+    bool started[LANDMARK_MAX_COUNT];
+    for(i = 0; i < threads; ++i) {
+        handles[i] = dmThread::New(LandmarkWorkerMain, 0x10000, &workers[i], "jps_landmarks");
+        started[i] = handles[i] != 0;
+    }
+    // A worker whose thread could not be created runs on this thread instead.
+    for(i = 0; i < threads; ++i) {
+        if(!started[i]) {
+            LandmarkWorkerMain(&workers[i]);
+        }
+    }
+    for(i = 0; i < threads; ++i) {
+        if(started[i]) {
+            dmThread::Join(handles[i]);
+        }
+    }
+#endif
+
+    lua_pushinteger(L, count);
     return 1;
 }
 
-// Main pathfinding function exposed to Lua as method on Grid instance
-// Parameters: self (Grid userdata), start_table, goal_table, heuristic_name (optional)
-// Returns: path table or nil plus error message
-static int FindPath(lua_State* L)
+// Parameters: self (Grid userdata)
+// Returns: the landmark tables as a binary string, or nil when none are computed
+static int SaveLandmarks(lua_State* L)
 {
-    DM_LUA_STACK_CHECK(L, 2);
+    DM_LUA_STACK_CHECK(L, 1);
 
-    // Get Grid instance from self (first parameter)
     GridWrapper* wrapper = CheckGridWrapper(L, 1);
-    
-    if(!wrapper->initialized) {
+    const LandmarkTable& table = wrapper->landmarks;
+    if(!table.ready()) {
         lua_pushnil(L);
-        lua_pushstring(L, "grid not initialized");
-        return 2;
+        return 1;
     }
+    const size_t size = table.save_size();
+    unsigned char* data = new unsigned char[size];
+    table.save(data);
+    lua_pushlstring(L, (const char*)data, size);
+    delete[] data;
+    return 1;
+}
 
-    luaL_checktype(L, 2, LUA_TTABLE);
-    Location start = ReadLocation(L, 2);
+// Parameters: self (Grid userdata), data (string from save_landmarks)
+// Returns: true, or false when the data is malformed or was saved for different walls
+static int LoadLandmarks(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
 
-    luaL_checktype(L, 3, LUA_TTABLE);
-    Location goal = ReadLocation(L, 3);
+    GridWrapper* wrapper = CheckGridWrapper(L, 1);
+    size_t size = 0;
+    const char* data = luaL_checklstring(L, 2, &size);
+    lua_pushboolean(L, wrapper->landmarks.load(wrapper->grid, (const unsigned char*)data, size));
+    return 1;
+}
 
-    heuristic_fn* heuristic = Tool::octile;
-    if(lua_gettop(L) >= 4 && lua_isstring(L, 4)) {
-        const char* heuristic_name = lua_tostring(L, 4);
-        if(strcmp(heuristic_name, "manhattan") == 0) {
-            heuristic = Tool::manhattan;
-        } else if(strcmp(heuristic_name, "euclidean") == 0) {
-            heuristic = Tool::euclidean;
-        } else if(strcmp(heuristic_name, "octile") == 0) {
-            heuristic = Tool::octile;
+// Parameters: self (Grid userdata)
+// Returns: bytes held by the grid (walls, chunks, overlay tiles, clearance map, landmark tables)
+static int GetMemoryBytes(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    GridWrapper* wrapper = CheckGridWrapper(L, 1);
+    lua_pushnumber(L, (lua_Number)wrapper->shared->memory_bytes());
+    return 1;
+}
+
+// Returns: table {total, search = {bytes, pages, page_bytes, table_bytes, queue_bytes},
+//          path_scratch, budget, grids = { {kind, width, height, bytes, handles, name}, ... },
+//          planners = {count, bytes}} with shared grids listed once
+static int MemoryStats(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    JpsMemoryStats search;
+    jps_memory_stats(&search);
+    const size_t search_bytes = search.page_bytes + search.table_bytes + search.queue_bytes;
+    size_t total = search_bytes + g_path_scratch.memory_bytes();
+
+    lua_createtable(L, 0, 6);
+
+    lua_createtable(L, 0, 5);
+    lua_pushnumber(L, (lua_Number)search_bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushinteger(L, search.pages);
+    lua_setfield(L, -2, "pages");
+    lua_pushnumber(L, (lua_Number)search.page_bytes);
+    lua_setfield(L, -2, "page_bytes");
+    lua_pushnumber(L, (lua_Number)search.table_bytes);
+    lua_setfield(L, -2, "table_bytes");
+    lua_pushnumber(L, (lua_Number)search.queue_bytes);
+    lua_setfield(L, -2, "queue_bytes");
+    lua_setfield(L, -2, "search");
+
+    lua_pushnumber(L, (lua_Number)g_path_scratch.memory_bytes());
+    lua_setfield(L, -2, "path_scratch");
+    lua_pushnumber(L, (lua_Number)jps_get_memory_budget());
+    lua_setfield(L, -2, "budget");
+
+    lua_newtable(L);
+    int index = 1;
+    SharedGrid* shared;
+    for(shared = SharedGrid::first; shared != 0; shared = shared->next) {
+        const Grid& grid = shared->grid;
+        const char* kind = grid.is_chunked() ? "chunked" : (grid.is_overlay() ? "overlay" : "flat");
+        const size_t bytes = shared->memory_bytes();
+        total += bytes;
+
+        lua_createtable(L, 0, 6);
+        lua_pushstring(L, kind);
+        lua_setfield(L, -2, "kind");
+        lua_pushinteger(L, grid.get_width());
+        lua_setfield(L, -2, "width");
+        lua_pushinteger(L, grid.get_height());
+        lua_setfield(L, -2, "height");
+        lua_pushnumber(L, (lua_Number)bytes);
+        lua_setfield(L, -2, "bytes");
+        lua_pushinteger(L, shared->refs - (shared->registered ? 1 : 0));
+        lua_setfield(L, -2, "handles");
+        if(shared->registered) {
+            dmScript::PushHash(L, shared->name);
+            lua_setfield(L, -2, "name");
         }
+        lua_rawseti(L, -2, index++);
     }
+    lua_setfield(L, -2, "grids");
 
-    Grid& grid = wrapper->grid;
+    int planner_count = 0;
+    size_t planner_bytes = 0;
+    PlannerWrapper* planner;
+    for(planner = PlannerWrapper::first; planner != 0; planner = planner->next) {
+        ++planner_count;
+        planner_bytes += planner->planner.memory_bytes();
+    }
+    total += planner_bytes;
+
+    lua_createtable(L, 0, 2);
+    lua_pushinteger(L, planner_count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, (lua_Number)planner_bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_setfield(L, -2, "planners");
+
+    lua_pushnumber(L, (lua_Number)total);
+    lua_setfield(L, -2, "total");
+    return 1;
+}
+
+// Frees pooled search memory, the path scratch buffer and slack in every grid
+// Returns: bytes freed
+static int Trim(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    size_t freed = jps_trim(0) + g_path_scratch.memory_bytes();
+    g_path_scratch.release();
+    SharedGrid* shared;
+    for(shared = SharedGrid::first; shared != 0; shared = shared->next) {
+        freed += shared->grid.trim();
+    }
+    lua_pushnumber(L, (lua_Number)freed);
+    return 1;
+}
+
+// Caps the memory the search keeps pooled between queries
+// Parameters: bytes (0 removes the cap)
+static int SetMemoryBudget(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 0);
+
+    lua_Number bytes = luaL_checknumber(L, 1);
+    luaL_argcheck(L, bytes >= 0, 1, "budget must not be negative");
+    jps_set_memory_budget((size_t)bytes);
+    return 0;
+}
+
+// Publishes the grid's walls under a name so other scripts can fetch them with
+// get_grid instead of building their own copy. The walls become read-only
+// for every handle, this one included.
+// Parameters: self (Grid userdata), name (string or hash)
+// Returns: true, or nil plus error message when the name is taken
+static int Publish(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 2);
+
+    GridWrapper* wrapper = CheckGridWrapper(L, 1);
+    const dmhash_t name = dmScript::CheckHashOrString(L, 2);
+    SharedGrid* shared = wrapper->shared;
+    if(shared->grid.is_overlay()) {
+        // The base could still change underneath a published overlay.
+        return luaL_error(L, "overlay grids cannot be published");
+    }
 
-    if(!grid.in_bounds(start) || !grid.passable(start)) {
+    SharedGrid* existing = FindPublishedGrid(name);
+    if(existing == shared) {
+        lua_pushboolean(L, 1);
         lua_pushnil(L);
-        lua_pushstring(L, "start position is invalid or blocked");
         return 2;
     }
-
-    if(!grid.in_bounds(goal) || !grid.passable(goal)) {
+    if(existing != 0 || shared->registered) {
         lua_pushnil(L);
-        lua_pushstring(L, "goal position is invalid or blocked");
+        lua_pushstring(L, existing != 0 ? "name is already published" : "grid is already published under another name");
         return 2;
     }
 
-    int max_nodes = grid.grid_size();
-    Location* path_buffer = new Location[max_nodes];
-    struct PathBufferGuard
-    {
-        Location* ptr;
-        PathBufferGuard(Location* p) : ptr(p) {}
-        ~PathBufferGuard() { if(ptr != 0) delete[] ptr; }
-        void release() { ptr = 0; }
-    } path_guard(path_buffer);
+    AcquireSharedGrid(shared);
+    shared->read_only = true;
+    shared->registered = true;
+    shared->name = name;
+    lua_pushboolean(L, 1);
+    lua_pushnil(L);
+    return 2;
+}
 
-    int path_length = jps_find_path(grid, start, goal, heuristic, path_buffer, max_nodes);
+// Parameters: name (string or hash)
+// Returns: a new handle (Grid userdata) to the published grid, or nil
+static int GetGrid(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
 
-    if(path_length <= 0) {
+    SharedGrid* shared = FindPublishedGrid(dmScript::CheckHashOrString(L, 1));
+    if(shared == 0) {
         lua_pushnil(L);
-        lua_pushstring(L, "no path found");
+        return 1;
+    }
+
+    GridWrapper* wrapper = (GridWrapper*)lua_newuserdata(L, sizeof(GridWrapper));
+    new (wrapper) GridWrapper(shared);
+
+    luaL_getmetatable(L, GRID_MT_NAME);
+    lua_setmetatable(L, -2);
+
+    wrapper->initialized = true;
+    return 1;
+}
+
+// Removes a name from the registry. Existing handles keep the grid alive and
+// it stays read-only; it is freed with the last handle.
+// Parameters: name (string or hash)
+// Returns: true when the name was published
+static int Unpublish(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    SharedGrid* shared = FindPublishedGrid(dmScript::CheckHashOrString(L, 1));
+    if(shared != 0) {
+        shared->registered = false;
+        ReleaseSharedGrid(shared);
+    }
+    lua_pushboolean(L, shared != 0);
+    return 1;
+}
+
+// Starts logging every find_path call, with snapshots of the grids they ran
+// on, for offline replay with tools/jps_replay. Replaces a running log.
+// Parameters: path
+// Returns: true, or nil plus error message
+static int StartRecording(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 2);
+
+    const char* path = luaL_checkstring(L, 1);
+    if(!g_recorder.open(path)) {
+        g_recorder.close();
+        lua_pushnil(L);
+        lua_pushfstring(L, "cannot write query log '%s'", path);
         return 2;
     }
+    lua_pushboolean(L, 1);
+    lua_pushnil(L);
+    return 2;
+}
 
-    lua_newtable(L);
-    int i;
-    for(i = 0; i < path_length; ++i) {
-        PushLocation(L, path_buffer[i]);
-        lua_rawseti(L, -2, i + 1);
+// Finishes the query log
+// Returns: number of queries recorded, or nil plus error message when a write failed
+static int StopRecording(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 2);
+
+    const int count = g_recorder.get_query_count();
+    if(!g_recorder.close()) {
+        lua_pushnil(L);
+        lua_pushstring(L, "failed writing the query log");
+        return 2;
     }
-    path_guard.release();
+    lua_pushinteger(L, count);
     lua_pushnil(L);
     return 2;
 }
@@ -199,6 +1549,14 @@ static int GridGC(lua_State* L)
 static const luaL_reg Module_methods[] =
 {
     {"create_grid", CreateGrid},
+    {"create_chunked_grid", CreateChunkedGrid},
+    {"memory_stats", MemoryStats},
+    {"trim", Trim},
+    {"set_memory_budget", SetMemoryBudget},
+    {"get_grid", GetGrid},
+    {"unpublish", Unpublish},
+    {"start_recording", StartRecording},
+    {"stop_recording", StopRecording},
     {0, 0}
 };
 
@@ -206,10 +1564,47 @@ static const luaL_reg Module_methods[] =
 static const luaL_reg Grid_methods[] =
 {
     {"find_path", FindPath},
+    {"set_blocked", SetBlocked},
+    {"clearance", GetClearance},
+    {"create_planner", CreatePlanner},
+    {"load_chunk", LoadChunk},
+    {"unload_chunk", UnloadChunk},
+    {"create_overlay", CreateOverlay},
+    {"clear_overlay", ClearOverlay},
+    {"calibrate", Calibrate},
+    {"memory_bytes", GetMemoryBytes},
+    {"version", GetVersion},
+    {"validate_path", ValidatePath},
+    {"validate_paths", ValidatePaths},
+    {"publish", Publish},
+    {"compute_landmarks", ComputeLandmarks},
+    {"save_landmarks", SaveLandmarks},
+    {"load_landmarks", LoadLandmarks},
     {"__gc", GridGC},
     {0, 0}
 };
 
+// PathIterator instance methods
+static const luaL_reg PathIterator_methods[] =
+{
+    {"next_cells", PathIteratorNextCells},
+    {"done", PathIteratorDone},
+    {"waypoints", PathIteratorWaypoints},
+    {"__gc", PathIteratorGC},
+    {0, 0}
+};
+
+// CooperativePlanner instance methods
+static const luaL_reg Planner_methods[] =
+{
+    {"plan", PlannerPlan},
+    {"clear", PlannerClear},
+    {"release", PlannerRelease},
+    {"advance", PlannerAdvance},
+    {"__gc", PlannerGC},
+    {0, 0}
+};
+
 static void LuaInit(lua_State* L)
 {
     int top = lua_gettop(L);
@@ -225,9 +1620,24 @@ static void LuaInit(lua_State* L)
     luaL_register(L, 0, Grid_methods);
     lua_pop(L, 1);
 
+    luaL_newmetatable(L, PATH_ITERATOR_MT_NAME);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    luaL_register(L, 0, PathIterator_methods);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, PLANNER_MT_NAME);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    luaL_register(L, 0, Planner_methods);
+    lua_pop(L, 1);
+
     // Register module-level functions
     luaL_register(L, MODULE_NAME, Module_methods);
 
+    lua_pushinteger(L, GRID_CHUNK_SIZE);
+    lua_setfield(L, -2, "CHUNK_SIZE");
+
     lua_pop(L, 1);
     assert(top == lua_gettop(L));
 }
@@ -248,7 +1658,20 @@ static dmExtension::Result AppInitializeDefWindwardJps(dmExtension::Params* para
 static dmExtension::Result FinalizeDefWindwardJps(dmExtension::Params* params)
 {
     (void)params;
+    g_recorder.close();
+    // Drop the registry's references; handles still alive free their grids
+    // when collected.
+    SharedGrid* shared = SharedGrid::first;
+    while(shared != 0) {
+        SharedGrid* next = shared->next;
+        if(shared->registered) {
+            shared->registered = false;
+            ReleaseSharedGrid(shared);
+        }
+        shared = next;
+    }
     jps_shutdown();
+    g_path_scratch.release();
     return dmExtension::RESULT_OK;
 }
 
@@ -1,5 +1,8 @@
 #include "grid.hpp"
+#include "overlay.hpp"
 #include <limits.h>
+#include <stdint.h>
+#include <string.h>
 
 static const Location ALL_DIRS[8] = {
     {1, 0}, {-1, 0},
@@ -10,6 +13,14 @@ static const Location ALL_DIRS[8] = {
 
 const Location NoneLoc = {-1, -1};
 
+// Shared tiles for uniform and unloaded chunks; never written through.
+static unsigned char g_open_chunk[GRID_CHUNK_CELLS];
+static unsigned char g_blocked_chunk[GRID_CHUNK_CELLS];
+static bool g_blocked_chunk_ready = false;
+
+// Source of grid versions; shared by every grid so versions never repeat.
+static unsigned int g_version_counter = 0;
+
 bool operator<(const Location& a, const Location& b)
 {
     if(a.x < b.x) return true;
@@ -22,6 +33,20 @@ Grid::Grid()
     , height(0)
     , walls_mask(0)
     , capacity(0)
+    , chunked(false)
+    , chunks_x(0)
+    , chunks_y(0)
+    , chunks(0)
+    , chunk_state(0)
+    , chunk_blocked(0)
+    , base(0)
+    , overlay(0)
+    , clearance_map(0)
+    , clearance_capacity(0)
+    , clearance_valid(false)
+    , version(0)
+    , history_floor(0)
+    , edit_count(0)
 {
 }
 
@@ -32,6 +57,47 @@ Grid::~Grid()
         walls_mask = 0;
     }
     capacity = 0;
+
+    if(clearance_map != 0) {
+        delete[] clearance_map;
+        clearance_map = 0;
+    }
+    clearance_capacity = 0;
+    clearance_valid = false;
+
+    release_chunks();
+    release_overlay();
+}
+
+void Grid::release_overlay()
+{
+    if(overlay != 0) {
+        delete overlay;
+        overlay = 0;
+    }
+    base = 0;
+}
+
+void Grid::release_chunks()
+{
+    if(chunks != 0) {
+        int count = chunks_x * chunks_y;
+        int i;
+        for(i = 0; i < count; ++i) {
+            if(chunk_state[i] == GRID_CHUNK_MIXED) {
+                delete[] chunks[i];
+            }
+        }
+        delete[] chunks;
+        delete[] chunk_state;
+        delete[] chunk_blocked;
+        chunks = 0;
+        chunk_state = 0;
+        chunk_blocked = 0;
+    }
+    chunks_x = 0;
+    chunks_y = 0;
+    chunked = false;
 }
 
 void Grid::ensure_capacity(int size)
@@ -57,10 +123,122 @@ void Grid::ensure_capacity(int size)
     capacity = size;
 }
 
+size_t Grid::memory_bytes() const
+{
+    size_t bytes = (size_t)capacity + (size_t)clearance_capacity;
+    if(chunks != 0) {
+        const int count = chunks_x * chunks_y;
+        bytes += (size_t)count * (sizeof(unsigned char*) + sizeof(unsigned char) + sizeof(int));
+        int i;
+        for(i = 0; i < count; ++i) {
+            if(chunk_state[i] == GRID_CHUNK_MIXED) {
+                bytes += GRID_CHUNK_CELLS;
+            }
+        }
+    }
+    if(overlay != 0) {
+        bytes += overlay->memory_bytes();
+    }
+    return bytes;
+}
+
+size_t Grid::trim()
+{
+    const size_t before = memory_bytes();
+
+    if(clearance_map != 0) {
+        delete[] clearance_map;
+        clearance_map = 0;
+    }
+    clearance_capacity = 0;
+    clearance_valid = false;
+
+    const int size = (walls_mask != 0) ? grid_size() : 0;
+    if(capacity > size) {
+        unsigned char* new_mask = 0;
+        if(size > 0) {
+            new_mask = new unsigned char[size];
+            memcpy(new_mask, walls_mask, size);
+        }
+        delete[] walls_mask;
+        walls_mask = new_mask;
+        capacity = size;
+    }
+
+    return before - memory_bytes();
+}
+
+void Grid::touch()
+{
+    version = ++g_version_counter;
+    history_floor = version;
+    edit_count = 0;
+}
+
+void Grid::touch(int min_x, int min_y, int max_x, int max_y)
+{
+    version = ++g_version_counter;
+    GridEdit& edit = edits[edit_count % GRID_EDIT_HISTORY];
+    if(edit_count >= GRID_EDIT_HISTORY && edit.version > history_floor) {
+        history_floor = edit.version;
+    }
+    edit.version = version;
+    edit.rect.min_x = min_x;
+    edit.rect.min_y = min_y;
+    edit.rect.max_x = max_x;
+    edit.rect.max_y = max_y;
+    ++edit_count;
+}
+
+int Grid::edits_since(unsigned int since, GridRect* out, int max_count) const
+{
+    int count = 0;
+    if(since < version) {
+        if(since < history_floor) {
+            return -1;
+        }
+        // Newest first; the ring is in version order, so stop at `since`.
+        const int stored = edit_count < GRID_EDIT_HISTORY ? edit_count : GRID_EDIT_HISTORY;
+        int i;
+        for(i = 1; i <= stored; ++i) {
+            const GridEdit& edit = edits[(edit_count - i) % GRID_EDIT_HISTORY];
+            if(edit.version <= since) {
+                break;
+            }
+            if(count == max_count) {
+                return -1;
+            }
+            out[count++] = edit.rect;
+        }
+    }
+    if(base != 0) {
+        const int base_count = base->edits_since(since, out + count, max_count - count);
+        if(base_count < 0) {
+            return -1;
+        }
+        count += base_count;
+    }
+    return count;
+}
+
+unsigned int Grid::get_version() const
+{
+    if(base != 0) {
+        const unsigned int base_version = base->get_version();
+        return base_version > version ? base_version : version;
+    }
+    return version;
+}
+
 void Grid::reset(int width_, int height_)
 {
+    release_chunks();
+    release_overlay();
+    touch();
+
     width = width_;
     height = height_;
+    clearance_valid = false;
 
     if(width > 0 && height > 0 && width > (INT_MAX / height)) {
         width = 0;
@@ -77,32 +255,280 @@ void Grid::reset(int width_, int height_)
     }
 }
 
+void Grid::reset_chunked(int width_, int height_)
+{
+    release_chunks();
+    release_overlay();
+    touch();
+    clearance_valid = false;
+
+    // Drop any flat storage; a chunked world is expected to be large.
+    if(walls_mask != 0) {
+        delete[] walls_mask;
+        walls_mask = 0;
+    }
+    capacity = 0;
+
+    width = width_;
+    height = height_;
+    if(width <= 0 || height <= 0 || width > (INT_MAX / height)) {
+        width = 0;
+        height = 0;
+        return;
+    }
+
+    if(!g_blocked_chunk_ready) {
+        memset(g_blocked_chunk, 1, sizeof(g_blocked_chunk));
+        g_blocked_chunk_ready = true;
+    }
+
+    chunked = true;
+    chunks_x = (width + GRID_CHUNK_MASK) >> GRID_CHUNK_SHIFT;
+    chunks_y = (height + GRID_CHUNK_MASK) >> GRID_CHUNK_SHIFT;
+    const int count = chunks_x * chunks_y;
+    chunks = new unsigned char*[count];
+    chunk_state = new unsigned char[count];
+    chunk_blocked = new int[count];
+
+    int i;
+    for(i = 0; i < count; ++i) {
+        chunks[i] = g_blocked_chunk;
+        chunk_state[i] = GRID_CHUNK_UNLOADED;
+        chunk_blocked[i] = 0;
+    }
+}
+
+void Grid::reset_overlay(const Grid* base_)
+{
+    release_chunks();
+    release_overlay();
+    touch();
+    clearance_valid = false;
+
+    if(walls_mask != 0) {
+        delete[] walls_mask;
+        walls_mask = 0;
+    }
+    capacity = 0;
+
+    base = base_;
+    width = base->get_width();
+    height = base->get_height();
+    overlay = new OverlayTiles();
+}
+
+void Grid::clear_overlay()
+{
+    if(overlay != 0 && overlay->tile_count() > 0) {
+        overlay->clear();
+        touch();
+    }
+}
+
+bool Grid::overrides_in(const GridRect& rect) const
+{
+    const Grid* grid;
+    for(grid = this; grid != 0 && grid->overlay != 0; grid = grid->base) {
+        if(grid->overlay->tiles_in(rect.min_x, rect.min_y, rect.max_x, rect.max_y)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int Grid::chunk_area(int cx, int cy) const
+{
+    int w = width - (cx << GRID_CHUNK_SHIFT);
+    int h = height - (cy << GRID_CHUNK_SHIFT);
+    if(w > GRID_CHUNK_SIZE) { w = GRID_CHUNK_SIZE; }
+    if(h > GRID_CHUNK_SIZE) { h = GRID_CHUNK_SIZE; }
+    return w * h;
+}
+
+void Grid::set_chunk_uniform(int chunk, GridChunkState state)
+{
+    if(chunk_state[chunk] == GRID_CHUNK_MIXED) {
+        delete[] chunks[chunk];
+    }
+    chunks[chunk] = (state == GRID_CHUNK_OPEN) ? g_open_chunk : g_blocked_chunk;
+    chunk_state[chunk] = (unsigned char)state;
+}
+
+GridChunkState Grid::get_chunk_state(int cx, int cy) const
+{
+    if(!chunk_in_bounds(cx, cy)) {
+        return GRID_CHUNK_UNLOADED;
+    }
+    return (GridChunkState)chunk_state[cy * chunks_x + cx];
+}
+
+void Grid::load_chunk(int cx, int cy, bool blocked)
+{
+    if(!chunk_in_bounds(cx, cy)) {
+        return;
+    }
+    const int chunk = cy * chunks_x + cx;
+    touch(cx << GRID_CHUNK_SHIFT, cy << GRID_CHUNK_SHIFT, ((cx + 1) << GRID_CHUNK_SHIFT) - 1, ((cy + 1) << GRID_CHUNK_SHIFT) - 1);
+    set_chunk_uniform(chunk, blocked ? GRID_CHUNK_BLOCKED : GRID_CHUNK_OPEN);
+    chunk_blocked[chunk] = blocked ? chunk_area(cx, cy) : 0;
+}
+
+void Grid::unload_chunk(int cx, int cy)
+{
+    if(!chunk_in_bounds(cx, cy)) {
+        return;
+    }
+    const int chunk = cy * chunks_x + cx;
+    touch(cx << GRID_CHUNK_SHIFT, cy << GRID_CHUNK_SHIFT, ((cx + 1) << GRID_CHUNK_SHIFT) - 1, ((cy + 1) << GRID_CHUNK_SHIFT) - 1);
+    set_chunk_uniform(chunk, GRID_CHUNK_UNLOADED);
+    chunk_blocked[chunk] = 0;
+}
+
+void Grid::set_chunk_blocked(const Location& loc, bool blocked)
+{
+    const int cx = loc.x >> GRID_CHUNK_SHIFT;
+    const int cy = loc.y >> GRID_CHUNK_SHIFT;
+    const int chunk = cy * chunks_x + cx;
+    if(chunk_state[chunk] == GRID_CHUNK_UNLOADED) {
+        return;
+    }
+
+    const int local = ((loc.y & GRID_CHUNK_MASK) << GRID_CHUNK_SHIFT) | (loc.x & GRID_CHUNK_MASK);
+    const unsigned char value = blocked ? 1 : 0;
+    if(chunks[chunk][local] == value) {
+        return;
+    }
+    touch(loc.x, loc.y, loc.x, loc.y);
+
+    const int area = chunk_area(cx, cy);
+    chunk_blocked[chunk] += blocked ? 1 : -1;
+    if(chunk_blocked[chunk] == 0) {
+        set_chunk_uniform(chunk, GRID_CHUNK_OPEN);
+        return;
+    }
+    if(chunk_blocked[chunk] == area) {
+        set_chunk_uniform(chunk, GRID_CHUNK_BLOCKED);
+        return;
+    }
+
+    if(chunk_state[chunk] != GRID_CHUNK_MIXED) {
+        // Copy on first write out of a shared tile.
+        unsigned char* tile = new unsigned char[GRID_CHUNK_CELLS];
+        memcpy(tile, chunks[chunk], GRID_CHUNK_CELLS);
+        chunks[chunk] = tile;
+        chunk_state[chunk] = GRID_CHUNK_MIXED;
+    }
+    chunks[chunk][local] = value;
+}
+
 void Grid::set_blocked(const Location& loc, bool blocked)
 {
     if(!in_bounds(loc)) {
         return;
     }
-    walls_mask[to_index(loc)] = blocked ? 1 : 0;
+    if(chunked) {
+        set_chunk_blocked(loc, blocked);
+        return;
+    }
+    if(overlay != 0) {
+        if(overlay->lookup(loc.x, loc.y) == (blocked ? 1 : 0)) {
+            return;
+        }
+        // An override equal to the base still pins the cell, but leaves the
+        // walls as they are.
+        const bool was_blocked = !passable(loc);
+        overlay->set(loc.x, loc.y, blocked);
+        if(was_blocked != blocked) {
+            touch(loc.x, loc.y, loc.x, loc.y);
+        }
+        return;
+    }
+    const int index = to_index(loc);
+    const unsigned char value = blocked ? 1 : 0;
+    if(walls_mask[index] == value) {
+        return;
+    }
+    walls_mask[index] = value;
+    touch(loc.x, loc.y, loc.x, loc.y);
+
+    if(clearance_valid) {
+        // Only cells up and to the left of the edit see it within the cap.
+        update_clearance(loc.x, loc.y, loc.x - (GRID_MAX_CLEARANCE - 1), loc.y - (GRID_MAX_CLEARANCE - 1));
+    }
+}
+
+void Grid::update_clearance(int x_from, int y_from, int x_to, int y_to) const
+{
+    if(x_to < 0) { x_to = 0; }
+    if(y_to < 0) { y_to = 0; }
+
+    int y;
+    for(y = y_from; y >= y_to; --y) {
+        int x;
+        for(x = x_from; x >= x_to; --x) {
+            const int index = y * width + x;
+            if(walls_mask[index] != 0) {
+                clearance_map[index] = 0;
+                continue;
+            }
+            int right = (x + 1 < width) ? clearance_map[index + 1] : 0;
+            int down = (y + 1 < height) ? clearance_map[index + width] : 0;
+            int diagonal = (x + 1 < width && y + 1 < height) ? clearance_map[index + width + 1] : 0;
+            int smallest = right < down ? right : down;
+            if(diagonal < smallest) {
+                smallest = diagonal;
+            }
+            clearance_map[index] = (unsigned char)(smallest + 1 < GRID_MAX_CLEARANCE ? smallest + 1 : GRID_MAX_CLEARANCE);
+        }
+    }
+}
+
+void Grid::ensure_clearance() const
+{
+    if(clearance_valid || !supports_clearance()) {
+        return;
+    }
+
+    const int size = grid_size();
+    if(size > clearance_capacity) {
+        if(clearance_map != 0) {
+            delete[] clearance_map;
+        }
+        clearance_map = new unsigned char[size];
+        clearance_capacity = size;
+    }
+
+    if(size > 0) {
+        update_clearance(width - 1, height - 1, 0, 0);
+    }
+    clearance_valid = true;
 }
 
-bool Grid::passable(const Location& loc) const
+int Grid::clearance_at(const Location& loc) const
 {
     if(!in_bounds(loc)) {
-        return false;
+        return 0;
     }
-    return walls_mask[to_index(loc)] == 0;
+    if(!supports_clearance()) {
+        return passable(loc) ? 1 : 0;
+    }
+    ensure_clearance();
+    return clearance_map[to_index(loc)];
 }
 
-bool Grid::valid_move(const Location& loc, const Location& dir) const
+bool Grid::passable_slow(const Location& loc, int clearance) const
 {
-    Location next_loc = loc + dir;
-    if(dir.x != 0 && dir.y != 0) {
-        Location dir_x = make_location(dir.x, 0);
-        Location dir_y = make_location(0, dir.y);
-        return in_bounds(next_loc) && passable(next_loc)
-            && (passable(loc + dir_x) || passable(loc + dir_y));
+    if(clearance > 1) {
+        return clearance_map[to_index(loc)] >= clearance;
+    }
+    if(overlay != 0) {
+        int value = overlay->lookup(loc.x, loc.y);
+        return value < 0 ? base->passable(loc) : value == 0;
     }
-    return in_bounds(next_loc) && passable(next_loc);
+    if(chunked) {
+        return *chunk_cell(loc.x, loc.y) == 0;
+    }
+    return walls_mask[to_index(loc)] == 0;
 }
 
 bool Grid::forced(const Location& loc, const Location& parent, const Location& travel_dir) const
@@ -120,13 +546,124 @@ bool Grid::forced(const Location& loc, const Location& parent, const Location& t
     return false;
 }
 
-int Grid::neighbours(const Location& current, const Location* dirs, int dir_count, Location* out, int max_count) const
+bool Grid::span_passable(int y, int x0, int x1, int clearance) const
+{
+    if(x0 > x1) {
+        int temp = x0;
+        x0 = x1;
+        x1 = temp;
+    }
+    if(y < 0 || y >= height || x0 < 0 || x1 >= width) {
+        return false;
+    }
+    if(clearance > 1) {
+        const unsigned char* row = clearance_map + y * width;
+        int x;
+        for(x = x0; x <= x1; ++x) {
+            if(row[x] < clearance) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if(overlay != 0) {
+        if(!overlay->row_overlaps(y, x0, x1)) {
+            return base->span_passable(y, x0, x1);
+        }
+        int x;
+        for(x = x0; x <= x1; ++x) {
+            if(!passable(make_location(x, y))) {
+                return false;
+            }
+        }
+        return true;
+    }
+    // Blocked cells hold exactly 1, so memchr tests the row a word at a time.
+    if(chunked) {
+        while(x0 <= x1) {
+            int run_end = (x0 | GRID_CHUNK_MASK);
+            if(run_end > x1) {
+                run_end = x1;
+            }
+            if(memchr(chunk_cell(x0, y), 1, (size_t)(run_end - x0 + 1)) != 0) {
+                return false;
+            }
+            x0 = run_end + 1;
+        }
+        return true;
+    }
+    const unsigned char* row = walls_mask + y * width;
+    return memchr(row + x0, 1, (size_t)(x1 - x0 + 1)) == 0;
+}
+
+static inline int64_t floor_div(int64_t a, int64_t b)
+{
+    int64_t q = a / b;
+    if((a % b != 0) && ((a < 0) != (b < 0))) {
+        --q;
+    }
+    return q;
+}
+
+bool Grid::line_of_sight(const Location& a, const Location& b, int clearance) const
+{
+    if(!in_bounds(a) || !in_bounds(b)) {
+        return false;
+    }
+    if(a.y == b.y) {
+        return span_passable(a.y, a.x, b.x, clearance);
+    }
+
+    // Walk rows from the lower to the upper end point. Coordinates are doubled
+    // so cell centres are even and cell borders odd; x(Y) * dy is exact.
+    const Location lo = (a.y < b.y) ? a : b;
+    const Location hi = (a.y < b.y) ? b : a;
+    const int64_t dx = hi.x - lo.x;
+    const int64_t dy = hi.y - lo.y;
+
+    int r;
+    for(r = lo.y; r <= hi.y; ++r) {
+        const int64_t y_from = (r == lo.y) ? 2 * (int64_t)lo.y : 2 * (int64_t)r - 1;
+        const int64_t y_to = (r == hi.y) ? 2 * (int64_t)hi.y : 2 * (int64_t)r + 1;
+        const int64_t n_from = 2 * lo.x * dy + (y_from - 2 * lo.y) * dx;
+        const int64_t n_to = 2 * lo.x * dy + (y_to - 2 * lo.y) * dx;
+        const int64_t n_min = n_from < n_to ? n_from : n_to;
+        const int64_t n_max = n_from < n_to ? n_to : n_from;
+
+        // Cells whose interior the segment enters within this row.
+        const int x_first = (int)(floor_div(n_min - dy, 2 * dy) + 1);
+        const int x_last = (int)(-floor_div(-(n_max + dy), 2 * dy) - 1);
+        if(!span_passable(r, x_first, x_last, clearance)) {
+            return false;
+        }
+
+        if(r == hi.y || dx == 0) {
+            continue;
+        }
+
+        // Passing exactly through a corner on the border to the next row.
+        const int64_t n_border = n_to;
+        if(n_border % dy == 0 && ((n_border / dy) & 1) != 0) {
+            const int left = (int)floor_div(n_border / dy, 2);
+            const int right = left + 1;
+            const Location side_a = make_location(dx > 0 ? right : left, r);
+            const Location side_b = make_location(dx > 0 ? left : right, r + 1);
+            if(!passable(side_a, clearance) && !passable(side_b, clearance)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+int Grid::neighbours(const Location& current, const Location* dirs, int dir_count, Location* out, int max_count, int clearance) const
 {
     int count = 0;
     int i;
     for(i = 0; i < dir_count && count < max_count; ++i) {
         const Location& dir = dirs[i];
-        if(valid_move(current, dir)) {
+        if(valid_move(current, dir, clearance)) {
             out[count] = current + dir;
             ++count;
         }
@@ -134,10 +671,10 @@ int Grid::neighbours(const Location& current, const Location* dirs, int dir_coun
     return count;
 }
 
-int Grid::pruned_neighbours(const Location& current, const Location& parent, Location* out, int max_count) const
+int Grid::pruned_neighbours(const Location& current, const Location& parent, Location* out, int max_count, int clearance) const
 {
     if(parent == NoneLoc) {
-        return neighbours(current, ALL_DIRS, 8, out, max_count);
+        return neighbours(current, ALL_DIRS, 8, out, max_count, clearance);
     }
 
     int count = 0;
@@ -151,7 +688,7 @@ int Grid::pruned_neighbours(const Location& current, const Location& parent, Loc
         diagonal_dirs[0] = dir;
         diagonal_dirs[1] = dir_x;
         diagonal_dirs[2] = dir_y;
-        count = neighbours(current, diagonal_dirs, 3, out, max_count);
+        count = neighbours(current, diagonal_dirs, 3, out, max_count, clearance);
 
         Location previous = current - dir;
         Location forced_dirs[2];
@@ -161,7 +698,7 @@ int Grid::pruned_neighbours(const Location& current, const Location& parent, Loc
         for(i = 0; i < 2; ++i) {
             const Location& candidate_dir = forced_dirs[i];
             Location double_candidate = candidate_dir * 2;
-            if(!valid_move(previous, candidate_dir) && valid_move(previous, double_candidate)) {
+            if(!valid_move(previous, candidate_dir, clearance) && valid_move(previous, double_candidate, clearance)) {
                 if(count < max_count) {
                     out[count] = previous + double_candidate;
                     ++count;
@@ -172,19 +709,19 @@ int Grid::pruned_neighbours(const Location& current, const Location& parent, Loc
     else {
         Location cardinal_dir[1];
         cardinal_dir[0] = dir;
-        count = neighbours(current, cardinal_dir, 1, out, max_count);
+        count = neighbours(current, cardinal_dir, 1, out, max_count, clearance);
 
         Location inverted_dir = make_location(dir.y, dir.x);
         Location neg_inverted_dir = make_location(-inverted_dir.x, -inverted_dir.y);
         Location inverted_plus_dir = inverted_dir + dir;
         Location neg_inverted_plus_dir = neg_inverted_dir + dir;
-        if(!valid_move(current, inverted_dir) && valid_move(current, inverted_plus_dir)) {
+        if(!valid_move(current, inverted_dir, clearance) && valid_move(current, inverted_plus_dir, clearance)) {
             if(count < max_count) {
                 out[count] = current + inverted_plus_dir;
                 ++count;
             }
         }
-        if(!valid_move(current, neg_inverted_dir) && valid_move(current, neg_inverted_plus_dir)) {
+        if(!valid_move(current, neg_inverted_dir, clearance) && valid_move(current, neg_inverted_plus_dir, clearance)) {
             if(count < max_count) {
                 out[count] = current + neg_inverted_plus_dir;
                 ++count;
@@ -62,6 +62,41 @@ inline Location operator*(const Location& a, const int b) {
 
 extern const Location NoneLoc;
 
+class OverlayTiles;
+
+// Clearance values are capped so a wall edit only has to revisit a
+// GRID_MAX_CLEARANCE x GRID_MAX_CLEARANCE block of the clearance map.
+#define GRID_MAX_CLEARANCE 32
+
+// Number of recent edits remembered for edits_since.
+#define GRID_EDIT_HISTORY 32
+
+// Inclusive cell rectangle
+struct GridRect
+{
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+};
+
+// Chunked grids store walls in fixed GRID_CHUNK_SIZE x GRID_CHUNK_SIZE tiles.
+#define GRID_CHUNK_SHIFT 6
+#define GRID_CHUNK_SIZE (1 << GRID_CHUNK_SHIFT)
+#define GRID_CHUNK_MASK (GRID_CHUNK_SIZE - 1)
+#define GRID_CHUNK_CELLS (GRID_CHUNK_SIZE * GRID_CHUNK_SIZE)
+
+enum GridChunkState
+{
+    // Not streamed in; every cell reads as blocked.
+    GRID_CHUNK_UNLOADED = 0,
+    // Uniform chunks share one static tile and own no memory.
+    GRID_CHUNK_OPEN,
+    GRID_CHUNK_BLOCKED,
+    // Owns its own GRID_CHUNK_CELLS mask.
+    GRID_CHUNK_MIXED
+};
+
 class Grid
 {
 private:
@@ -70,7 +105,63 @@ private:
     unsigned char* walls_mask;
     int capacity;
 
+    // Chunked backend, used instead of walls_mask for very large worlds.
+    // Every chunk pointer is valid: uniform and unloaded chunks point at a
+    // shared all-open or all-blocked tile, so lookups never branch on state.
+    bool chunked;
+    int chunks_x;
+    int chunks_y;
+    unsigned char** chunks;
+    unsigned char* chunk_state;
+    // Blocked cells per chunk; a chunk collapses back to a shared tile once
+    // it becomes uniform again.
+    int* chunk_blocked;
+
+    // Overlay backend: reads fall through to `base` except for cells edited
+    // on this grid, which live in copy-on-write tiles.
+    const Grid* base;
+    OverlayTiles* overlay;
+
+    // True clearance: side of the largest open square whose top-left cell is
+    // this cell. Built on the first query that needs it, then kept up to date
+    // incrementally by set_blocked.
+    mutable unsigned char* clearance_map;
+    mutable int clearance_capacity;
+    mutable bool clearance_valid;
+
+    // Bumped from a global counter on every change, see get_version.
+    unsigned int version;
+    // Ring of the last GRID_EDIT_HISTORY edited rectangles, for edits_since.
+    // Changes up to history_floor (resets, or edits pushed out of the ring)
+    // are not itemised.
+    struct GridEdit
+    {
+        unsigned int version;
+        GridRect rect;
+    };
+    GridEdit edits[GRID_EDIT_HISTORY];
+    unsigned int history_floor;
+    int edit_count;
+    // Records a change anywhere in the grid.
+    void touch();
+    // Records a change within the given cells.
+    void touch(int min_x, int min_y, int max_x, int max_y);
+
     void ensure_capacity(int size);
+    void update_clearance(int x_from, int y_from, int x_to, int y_to) const;
+
+    void release_chunks();
+    void release_overlay();
+    void set_chunk_uniform(int chunk, GridChunkState state);
+    int chunk_area(int cx, int cy) const;
+    void set_chunk_blocked(const Location& loc, bool blocked);
+    // passable() for clearance, chunked and overlay lookups
+    bool passable_slow(const Location& loc, int clearance) const;
+
+    inline const unsigned char* chunk_cell(int x, int y) const {
+        return chunks[(y >> GRID_CHUNK_SHIFT) * chunks_x + (x >> GRID_CHUNK_SHIFT)]
+            + (((y & GRID_CHUNK_MASK) << GRID_CHUNK_SHIFT) | (x & GRID_CHUNK_MASK));
+    }
 
     // Disable copying
     Grid(const Grid&);
@@ -81,8 +172,47 @@ public:
     ~Grid();
 
     void reset(int width_, int height_);
+    // Switches to chunked storage with every chunk unloaded.
+    void reset_chunked(int width_, int height_);
+    // Turns this grid into an overlay over `base_`, which must outlive it.
+    void reset_overlay(const Grid* base_);
+    // Drops every overlay edit, in O(edited tiles).
+    void clear_overlay();
     void set_blocked(const Location& loc, bool blocked);
 
+    // Bytes owned by this grid: walls, chunk tables and tiles, overlay tiles
+    // and the clearance map. Shared chunk tiles and an overlay's base are not
+    // counted.
+    size_t memory_bytes() const;
+    // Shrinks the wall mask to the current size and drops the clearance map,
+    // which is rebuilt on demand. Returns the number of bytes freed.
+    size_t trim();
+
+    // Changes whenever a cell may have changed (edits, resets, chunk loads).
+    // Versions come from one counter shared by all grids, so they are never
+    // reused; an overlay also reports its base's changes.
+    unsigned int get_version() const;
+    // Copies the rectangles edited after version `since` (an overlay's base
+    // included) to `out` and returns their number. Returns -1 when there are
+    // more than max_count, or when the history no longer reaches back.
+    int edits_since(unsigned int since, GridRect* out, int max_count) const;
+
+    bool is_chunked() const { return chunked; }
+    bool is_overlay() const { return overlay != 0; }
+    // One wall byte per cell: no chunks, no overlay.
+    bool is_flat() const { return !chunked && overlay == 0; }
+    const Grid* get_base() const { return base; }
+    // True when this overlay, or one below it, may override a cell in `rect`.
+    bool overrides_in(const GridRect& rect) const;
+    int get_chunks_x() const { return chunks_x; }
+    int get_chunks_y() const { return chunks_y; }
+    bool chunk_in_bounds(int cx, int cy) const { return chunked && 0 <= cx && cx < chunks_x && 0 <= cy && cy < chunks_y; }
+    GridChunkState get_chunk_state(int cx, int cy) const;
+    // Loads a chunk as all open or all blocked; individual walls can then be
+    // added with set_blocked. Edits to unloaded chunks are ignored.
+    void load_chunk(int cx, int cy, bool blocked);
+    void unload_chunk(int cx, int cy);
+
     int get_width() const { return width; }
     int get_height() const { return height; }
 
@@ -91,10 +221,45 @@ public:
     inline int grid_size() const { return width * height; }
 
     bool in_bounds(const Location& loc) const { return 0 <= loc.x && loc.x < width && 0 <= loc.y && loc.y < height; }
-    bool passable(const Location& loc) const;
-    bool valid_move(const Location& loc, const Location& dir) const;
+    // The clearance map is grid-sized and would go stale under an overlay,
+    // so it is only kept for flat grids.
+    bool supports_clearance() const { return is_flat(); }
+    // Builds the clearance map if it is not already valid.
+    void ensure_clearance() const;
+    int clearance_at(const Location& loc) const;
+
+    // With clearance > 1 a cell is passable only when a clearance x clearance
+    // unit anchored at its top-left corner fits; requires ensure_clearance().
+    // Flat grids read the wall mask directly; other backends go out of line.
+    inline bool passable(const Location& loc, int clearance = 1) const
+    {
+        if(!in_bounds(loc)) {
+            return false;
+        }
+        if(clearance <= 1 && !chunked && overlay == 0) {
+            return walls_mask[to_index(loc)] == 0;
+        }
+        return passable_slow(loc, clearance);
+    }
+    inline bool valid_move(const Location& loc, const Location& dir, int clearance = 1) const
+    {
+        const Location next_loc = loc + dir;
+        if(dir.x != 0 && dir.y != 0) {
+            return passable(next_loc, clearance)
+                && (passable(make_location(loc.x + dir.x, loc.y), clearance)
+                    || passable(make_location(loc.x, loc.y + dir.y), clearance));
+        }
+        return passable(next_loc, clearance);
+    }
     bool forced(const Location& loc, const Location& parent, const Location& travel_dir) const;
 
-    int neighbours(const Location& current, const Location* dirs, int dir_count, Location* out, int max_count) const;
-    int pruned_neighbours(const Location& current, const Location& parent, Location* out, int max_count) const;
+    // True when every cell in row y between x0 and x1 (inclusive) is passable.
+    bool span_passable(int y, int x0, int x1, int clearance = 1) const;
+    // Straight-line visibility between two cell centres. Tests every cell the
+    // segment passes through; where it crosses exactly through a cell corner
+    // one of the two side cells must be passable, matching valid_move.
+    bool line_of_sight(const Location& a, const Location& b, int clearance = 1) const;
+
+    int neighbours(const Location& current, const Location* dirs, int dir_count, Location* out, int max_count, int clearance = 1) const;
+    int pruned_neighbours(const Location& current, const Location& parent, Location* out, int max_count, int clearance = 1) const;
 };
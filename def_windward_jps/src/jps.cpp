@@ -2,6 +2,7 @@
 #include "tools.hpp"
 
 #include <float.h>
+#include <string.h>
 
 #define JPS_MAX_NEIGHBOURS 8
 
@@ -17,49 +18,206 @@ struct PriorityQueue {
 };
 
 static PriorityQueue g_priority_queue = {0, 0, 0};
+// Focal search keeps a second queue of nodes within the suboptimality bound,
+// ordered by g + w * h, and a queue of open nodes still outside it, ordered
+// by g + h.
+static PriorityQueue g_focal_queue = {0, 0, 0};
+static PriorityQueue g_focal_pending = {0, 0, 0};
+
+// Search state is paged: the grid is split into JPS_PAGE_SIZE x JPS_PAGE_SIZE
+// blocks and a page of nodes is attached only when the search first touches
+// a cell in that block. Memory and per-query reset cost scale with the area
+// explored, not with the size of the world.
+#define JPS_PAGE_SHIFT 5
+#define JPS_PAGE_SIZE (1 << JPS_PAGE_SHIFT)
+#define JPS_PAGE_MASK (JPS_PAGE_SIZE - 1)
+#define JPS_PAGE_CELLS (JPS_PAGE_SIZE * JPS_PAGE_SIZE)
+
+struct SearchNode {
+    Location came_from;
+    double cost_so_far;
+    unsigned char closed;
+};
 
-struct JpsBuffers {
-    Location* came_from;
-    double* cost_so_far;
-    unsigned char* closed_set;
-    int capacity;
+// Four cardinal jump results per cell, see jump_cardinal. 0 means unknown,
+// -1 no jump point, n > 0 a jump point n steps along the ray.
+#define JPS_JUMP_DIRS 4
+
+struct SearchPage {
+    SearchNode nodes[JPS_PAGE_CELLS];
+    int jumps[JPS_PAGE_CELLS * JPS_JUMP_DIRS];
+};
+
+struct SearchState {
+    SearchPage** page_table;
+    int page_table_capacity;
+    int pages_x;
+    // Every page ever allocated; pages [0, pages_used) are attached this query.
+    SearchPage** pages;
+    int pages_used;
+    int pages_allocated;
+    int pages_capacity;
+    // Page table slots attached this query, cleared at the next reset.
+    int* attached_slots;
 };
 
-static JpsBuffers g_jps_buffers = {0, 0, 0, 0};
+static SearchState g_search = {0, 0, 0, 0, 0, 0, 0, 0};
+
+// Cardinal jump results depend only on the cell, the direction, the goal and
+// the clearance, so within one query they are memoised in the search pages.
+// On open maps rays are long and almost never rescanned, and writing them
+// back costs more than it saves; once JPS_MEMO_WARMUP scans have run with
+// fewer than one hit per JPS_MEMO_MIN_HITS misses the memo is switched off
+// for the rest of the query.
+#define JPS_MEMO_WARMUP 256
+#define JPS_MEMO_MIN_HITS 16
+
+struct JumpMemo {
+    // Set during a query; cleared early when the memo stops paying off
+    bool caching;
+    int hits;
+    int misses;
+    int scanned;
+};
+
+static JumpMemo g_jump_memo = {false, 0, 0, 0};
+
+// Square around the start of a radius-limited query. Scans stop at its edge,
+// so the work per query stays bounded even on open maps.
+struct JumpBox {
+    bool active;
+    // Set when a scan or neighbour was cut off by the box
+    bool hit;
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+};
+
+static JumpBox g_jump_box = {false, false, 0, 0, 0, 0};
+
+static inline bool jump_box_contains(const Location& loc)
+{
+    if(!g_jump_box.active || (g_jump_box.min_x <= loc.x && loc.x <= g_jump_box.max_x
+        && g_jump_box.min_y <= loc.y && loc.y <= g_jump_box.max_y)) {
+        return true;
+    }
+    g_jump_box.hit = true;
+    return false;
+}
+
+JpsPath::JpsPath()
+    : points(0)
+    , size(0)
+    , capacity(0)
+{
+}
+
+JpsPath::~JpsPath()
+{
+    release();
+}
 
-struct BufferGuard
+bool JpsPath::reserve(int required)
 {
-    Location* came_from;
-    double* cost_so_far;
-    unsigned char* closed_set;
+    if(required <= capacity) {
+        return true;
+    }
+    if(required <= 0) {
+        return false;
+    }
+
+    Location* new_points = new Location[required];
+    int i;
+    for(i = 0; i < size; ++i) {
+        new_points[i] = points[i];
+    }
+    if(points != 0) {
+        delete[] points;
+    }
+    points = new_points;
+    capacity = required;
+    return true;
+}
 
-    BufferGuard()
-        : came_from(0)
-        , cost_so_far(0)
-        , closed_set(0)
-    {
+void JpsPath::release()
+{
+    if(points != 0) {
+        delete[] points;
+        points = 0;
     }
+    size = 0;
+    capacity = 0;
+}
+
+static inline int abs_int(int v)
+{
+    return v < 0 ? -v : v;
+}
+
+static inline int sign_int(int v)
+{
+    return (v > 0) - (v < 0);
+}
+
+void PathCursor::reset(const Location* waypoints_, int count_)
+{
+    waypoints = waypoints_;
+    count = count_;
+    segment = 0;
+    step = 0;
+}
 
-    ~BufferGuard()
-    {
-        if(closed_set != 0) {
-            delete[] closed_set;
+bool PathCursor::done() const
+{
+    if(count == 1) {
+        return step > 0;
+    }
+    return segment >= count - 1;
+}
+
+int PathCursor::next_cells(Location* out, int max_count)
+{
+    int written = 0;
+
+    if(count == 1) {
+        if(step == 0 && max_count > 0) {
+            out[0] = waypoints[0];
+            step = 1;
+            written = 1;
         }
-        if(cost_so_far != 0) {
-            delete[] cost_so_far;
+        return written;
+    }
+
+    while(written < max_count && segment < count - 1) {
+        const Location& a = waypoints[segment];
+        const Location& b = waypoints[segment + 1];
+        const int dx = b.x - a.x;
+        const int dy = b.y - a.y;
+        const int adx = abs_int(dx);
+        const int ady = abs_int(dy);
+        const int steps = adx > ady ? adx : ady;
+
+        if(step <= steps) {
+            // Cell k of the segment, rounded to the nearest cell along the
+            // minor axis; the first segment also emits its start cell.
+            Location cell = a;
+            if(steps > 0) {
+                cell.x += sign_int(dx) * ((2 * step * adx + steps) / (2 * steps));
+                cell.y += sign_int(dy) * ((2 * step * ady + steps) / (2 * steps));
+            }
+            out[written] = cell;
+            ++written;
+            ++step;
         }
-        if(came_from != 0) {
-            delete[] came_from;
+        if(step > steps) {
+            ++segment;
+            step = 1;
         }
     }
 
-    void release()
-    {
-        came_from = 0;
-        cost_so_far = 0;
-        closed_set = 0;
-    }
-};
+    return written;
+}
 
 static void pq_swap(PQElement* a, PQElement* b)
 {
@@ -165,123 +323,348 @@ static void pq_pop(PriorityQueue* pq, double* out_priority, Location* out_loc)
     }
 }
 
-static void ensure_jps_buffers(int required)
+static void search_release()
 {
-    if(required <= g_jps_buffers.capacity) {
-        return;
+    int i;
+    for(i = 0; i < g_search.pages_allocated; ++i) {
+        delete g_search.pages[i];
+    }
+    if(g_search.pages != 0) {
+        delete[] g_search.pages;
     }
+    if(g_search.attached_slots != 0) {
+        delete[] g_search.attached_slots;
+    }
+    if(g_search.page_table != 0) {
+        delete[] g_search.page_table;
+    }
+    SearchState empty = {0, 0, 0, 0, 0, 0, 0, 0};
+    g_search = empty;
+}
 
-    BufferGuard guard;
-    guard.came_from = new Location[required];
-    guard.cost_so_far = new double[required];
-    guard.closed_set = new unsigned char[required];
+// Detaches the pages used by the previous query and sizes the page table
+// for this grid. Only previously attached slots are touched.
+static void search_reset(const Grid& grid)
+{
+    const int pages_x = (grid.get_width() + JPS_PAGE_MASK) >> JPS_PAGE_SHIFT;
+    const int pages_y = (grid.get_height() + JPS_PAGE_MASK) >> JPS_PAGE_SHIFT;
+    const int table_size = pages_x * pages_y;
 
-    if(g_jps_buffers.came_from != 0) {
-        delete[] g_jps_buffers.came_from;
+    int i;
+    for(i = 0; i < g_search.pages_used; ++i) {
+        g_search.page_table[g_search.attached_slots[i]] = 0;
     }
-    if(g_jps_buffers.cost_so_far != 0) {
-        delete[] g_jps_buffers.cost_so_far;
+    g_search.pages_used = 0;
+    g_search.pages_x = pages_x;
+
+    if(table_size > g_search.page_table_capacity) {
+        if(g_search.page_table != 0) {
+            delete[] g_search.page_table;
+        }
+        g_search.page_table = new SearchPage*[table_size];
+        for(i = 0; i < table_size; ++i) {
+            g_search.page_table[i] = 0;
+        }
+        g_search.page_table_capacity = table_size;
     }
-    if(g_jps_buffers.closed_set != 0) {
-        delete[] g_jps_buffers.closed_set;
+}
+
+static SearchPage* search_attach_page(int slot)
+{
+    if(g_search.pages_used == g_search.pages_allocated) {
+        if(g_search.pages_allocated == g_search.pages_capacity) {
+            int new_capacity = (g_search.pages_capacity == 0) ? 16 : g_search.pages_capacity * 2;
+            SearchPage** new_pages = new SearchPage*[new_capacity];
+            int* new_slots = new int[new_capacity];
+            int i;
+            for(i = 0; i < g_search.pages_allocated; ++i) {
+                new_pages[i] = g_search.pages[i];
+            }
+            for(i = 0; i < g_search.pages_used; ++i) {
+                new_slots[i] = g_search.attached_slots[i];
+            }
+            if(g_search.pages != 0) {
+                delete[] g_search.pages;
+            }
+            if(g_search.attached_slots != 0) {
+                delete[] g_search.attached_slots;
+            }
+            g_search.pages = new_pages;
+            g_search.attached_slots = new_slots;
+            g_search.pages_capacity = new_capacity;
+        }
+        g_search.pages[g_search.pages_allocated] = new SearchPage;
+        g_search.pages_allocated += 1;
     }
 
-    g_jps_buffers.came_from = guard.came_from;
-    g_jps_buffers.cost_so_far = guard.cost_so_far;
-    g_jps_buffers.closed_set = guard.closed_set;
-    g_jps_buffers.capacity = required;
+    SearchPage* page = g_search.pages[g_search.pages_used];
+    g_search.attached_slots[g_search.pages_used] = slot;
+    g_search.pages_used += 1;
 
-    guard.release();
+    int i;
+    for(i = 0; i < JPS_PAGE_CELLS; ++i) {
+        page->nodes[i].came_from = NoneLoc;
+        page->nodes[i].cost_so_far = DBL_MAX;
+        page->nodes[i].closed = 0;
+    }
+    memset(page->jumps, 0, sizeof(page->jumps));
+    g_search.page_table[slot] = page;
+    return page;
 }
 
-static void reset_jps_buffers(int size)
+static inline SearchPage* search_page(const Location& loc)
 {
-    int i;
-    for(i = 0; i < size; ++i) {
-        g_jps_buffers.came_from[i] = NoneLoc;
-        g_jps_buffers.cost_so_far[i] = DBL_MAX;
-        g_jps_buffers.closed_set[i] = 0;
+    const int slot = (loc.y >> JPS_PAGE_SHIFT) * g_search.pages_x + (loc.x >> JPS_PAGE_SHIFT);
+    SearchPage* page = g_search.page_table[slot];
+    if(page == 0) {
+        page = search_attach_page(slot);
     }
+    return page;
+}
+
+static inline int search_cell(const Location& loc)
+{
+    return ((loc.y & JPS_PAGE_MASK) << JPS_PAGE_SHIFT) | (loc.x & JPS_PAGE_MASK);
+}
+
+static inline SearchNode& search_node(const Location& loc)
+{
+    return search_page(loc)->nodes[search_cell(loc)];
+}
+
+// Page lookup cached across a scan; a ray changes page only every
+// JPS_PAGE_SIZE cells, so most steps skip the page table.
+struct PageCursor {
+    int slot;
+    SearchPage* page;
+};
+
+static inline int& jump_memo_entry(PageCursor& cursor, const Location& loc, int dir_index)
+{
+    const int slot = (loc.y >> JPS_PAGE_SHIFT) * g_search.pages_x + (loc.x >> JPS_PAGE_SHIFT);
+    if(slot != cursor.slot) {
+        cursor.slot = slot;
+        cursor.page = g_search.page_table[slot];
+        if(cursor.page == 0) {
+            cursor.page = search_attach_page(slot);
+        }
+    }
+    return cursor.page->jumps[search_cell(loc) * JPS_JUMP_DIRS + dir_index];
+}
+
+static inline int cardinal_index(const Location& dir)
+{
+    if(dir.x != 0) {
+        return dir.x > 0 ? 0 : 1;
+    }
+    return dir.y > 0 ? 2 : 3;
+}
+
+static void pq_release(PriorityQueue* pq)
+{
+    if(pq->elements != 0) {
+        delete[] pq->elements;
+        pq->elements = 0;
+    }
+    pq->size = 0;
+    pq->capacity = 0;
 }
 
 void jps_shutdown()
 {
-    if(g_priority_queue.elements != 0) {
-        delete[] g_priority_queue.elements;
-        g_priority_queue.elements = 0;
-        g_priority_queue.size = 0;
-        g_priority_queue.capacity = 0;
+    pq_release(&g_priority_queue);
+    pq_release(&g_focal_queue);
+    pq_release(&g_focal_pending);
+    search_release();
+}
+
+// Soft cap on pooled search memory, applied after every query; 0 disables it.
+static size_t g_memory_budget = 0;
+
+void jps_memory_stats(JpsMemoryStats* out)
+{
+    out->pages = g_search.pages_allocated;
+    out->page_bytes = (size_t)g_search.pages_allocated * sizeof(SearchPage);
+    out->table_bytes = (size_t)g_search.page_table_capacity * sizeof(SearchPage*)
+        + (size_t)g_search.pages_capacity * (sizeof(SearchPage*) + sizeof(int));
+    out->queue_bytes = (size_t)(g_priority_queue.capacity + g_focal_queue.capacity
+        + g_focal_pending.capacity) * sizeof(PQElement);
+}
+
+size_t jps_memory_bytes()
+{
+    JpsMemoryStats stats;
+    jps_memory_stats(&stats);
+    return stats.page_bytes + stats.table_bytes + stats.queue_bytes;
+}
+
+size_t jps_trim(size_t max_bytes)
+{
+    const size_t before = jps_memory_bytes();
+
+    // Detach every page so any of them may be freed; the next query starts
+    // from an empty page table either way.
+    int i;
+    for(i = 0; i < g_search.pages_used; ++i) {
+        g_search.page_table[g_search.attached_slots[i]] = 0;
     }
+    g_search.pages_used = 0;
 
-    if(g_jps_buffers.came_from != 0) {
-        delete[] g_jps_buffers.came_from;
-        g_jps_buffers.came_from = 0;
+    while(g_search.pages_allocated > 0 && jps_memory_bytes() > max_bytes) {
+        g_search.pages_allocated -= 1;
+        delete g_search.pages[g_search.pages_allocated];
     }
-    if(g_jps_buffers.cost_so_far != 0) {
-        delete[] g_jps_buffers.cost_so_far;
-        g_jps_buffers.cost_so_far = 0;
+    if(jps_memory_bytes() > max_bytes) {
+        pq_release(&g_priority_queue);
+        pq_release(&g_focal_queue);
+        pq_release(&g_focal_pending);
     }
-    if(g_jps_buffers.closed_set != 0) {
-        delete[] g_jps_buffers.closed_set;
-        g_jps_buffers.closed_set = 0;
+    if(jps_memory_bytes() > max_bytes) {
+        search_release();
     }
-    g_jps_buffers.capacity = 0;
+    return before - jps_memory_bytes();
 }
 
-Location jump(const Grid& grid, const Location initial, const Location dir,
-    const Location goal)
+void jps_set_memory_budget(size_t max_bytes)
+{
+    g_memory_budget = max_bytes;
+    if(g_memory_budget > 0) {
+        jps_trim(g_memory_budget);
+    }
+}
+
+size_t jps_get_memory_budget()
+{
+    return g_memory_budget;
+}
+
+// True when the scan entering `loc` from `from` must stop there: the goal
+// or a cell with a forced neighbour.
+static bool jump_stops_at(const Grid& grid, const Location& from, const Location& loc,
+    const Location& dir, const Location& goal, int clearance)
 {
+    if(loc == goal) {
+        return true;
+    }
+
+    Location forced_neighbours[JPS_MAX_NEIGHBOURS];
+    int forced_count = grid.pruned_neighbours(loc, from, forced_neighbours, JPS_MAX_NEIGHBOURS, clearance);
+    int i;
+    for(i = 0; i < forced_count; ++i) {
+        if(grid.forced(forced_neighbours[i], loc, dir)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Horizontal or vertical scan. Every cell on a scanned ray shares its
+// result, so the whole ray is memoised and later scans that cross it stop
+// at the first known cell.
+static Location jump_cardinal(const Grid& grid, const Location& initial, const Location& dir,
+    const Location& goal, int clearance)
+{
+    const int dir_index = cardinal_index(dir);
     Location current = initial;
+    Location result = NoneLoc;
+    bool cached = false;
+    const bool caching = g_jump_memo.caching;
+    PageCursor cursor = {-1, 0};
+    int scanned = 0;
 
     while(1) {
-        Location new_loc = current + dir;
-        if(!grid.valid_move(current, dir)) {
-            return NoneLoc;
+        if(caching) {
+            const int known = jump_memo_entry(cursor, current, dir_index);
+            if(known != 0) {
+                if(known > 0) {
+                    result = make_location(current.x + dir.x * known, current.y + dir.y * known);
+                }
+                cached = true;
+                break;
+            }
         }
-
-        if(new_loc == goal) {
-            return new_loc;
+        const Location next = current + dir;
+        if(!grid.valid_move(current, dir, clearance) || !jump_box_contains(next)) {
+            break;
         }
+        scanned += 1;
+        if(jump_stops_at(grid, current, next, dir, goal, clearance)) {
+            result = next;
+            break;
+        }
+        current = next;
+    }
 
-        Location forced_neighbours[JPS_MAX_NEIGHBOURS];
-        int forced_count = grid.pruned_neighbours(new_loc, current, forced_neighbours, JPS_MAX_NEIGHBOURS);
-        int i;
-        for(i = 0; i < forced_count; ++i) {
-            const Location& next = forced_neighbours[i];
-            if(grid.forced(next, new_loc, dir)) {
-                return new_loc;
-            }
+    g_jump_memo.scanned += scanned;
+    if(cached) {
+        g_jump_memo.hits += 1;
+    }
+    else {
+        g_jump_memo.misses += 1;
+        if(g_jump_memo.misses >= JPS_MEMO_WARMUP
+            && g_jump_memo.hits * JPS_MEMO_MIN_HITS < g_jump_memo.misses) {
+            g_jump_memo.caching = false;
         }
+    }
 
-        if(dir.x != 0 && dir.y != 0) {
-            Location new_dirs[2];
-            new_dirs[0] = make_location(dir.x, 0);
-            new_dirs[1] = make_location(0, dir.y);
-            for(i = 0; i < 2; ++i) {
-                Location jump_point = jump(grid, new_loc, new_dirs[i], goal);
-                if(jump_point != NoneLoc) {
-                    return new_loc;
-                }
+    if(caching) {
+        // On a hit `current` is already known; otherwise it is the last cell
+        // scanned and gets the result too.
+        const Location stop = cached ? current : current + dir;
+        Location cell = initial;
+        while(cell != stop) {
+            int value = -1;
+            if(result != NoneLoc) {
+                value = abs_int(result.x - cell.x) + abs_int(result.y - cell.y);
             }
+            jump_memo_entry(cursor, cell, dir_index) = value;
+            cell = cell + dir;
         }
+    }
+    return result;
+}
 
-        current = new_loc;
+Location jump(const Grid& grid, const Location initial, const Location dir,
+    const Location goal, int clearance)
+{
+    if(dir.x == 0 || dir.y == 0) {
+        return jump_cardinal(grid, initial, dir, goal, clearance);
+    }
+
+    const Location dir_x = make_location(dir.x, 0);
+    const Location dir_y = make_location(0, dir.y);
+    Location current = initial;
+
+    while(1) {
+        const Location next = current + dir;
+        if(!grid.valid_move(current, dir, clearance) || !jump_box_contains(next)) {
+            return NoneLoc;
+        }
+        g_jump_memo.scanned += 1;
+        if(jump_stops_at(grid, current, next, dir, goal, clearance)) {
+            return next;
+        }
+        if(jump_cardinal(grid, next, dir_x, goal, clearance) != NoneLoc
+            || jump_cardinal(grid, next, dir_y, goal, clearance) != NoneLoc) {
+            return next;
+        }
+        current = next;
     }
 }
 
 int successors(const Grid& grid, const Location& current,
     const Location& parent, const Location& goal,
-    Location* out, int max_count)
+    Location* out, int max_count, int clearance)
 {
     Location neighbour_list[JPS_MAX_NEIGHBOURS];
-    int neighbour_count = grid.pruned_neighbours(current, parent, neighbour_list, JPS_MAX_NEIGHBOURS);
+    int neighbour_count = grid.pruned_neighbours(current, parent, neighbour_list, JPS_MAX_NEIGHBOURS, clearance);
 
     int out_count = 0;
     int i;
     for(i = 0; i < neighbour_count; ++i) {
         const Location& n = neighbour_list[i];
         Location direction = (n - current).direction();
-        Location jump_point = jump(grid, current, direction, goal);
+        Location jump_point = jump(grid, current, direction, goal, clearance);
         if(jump_point != NoneLoc && out_count < max_count) {
             out[out_count] = jump_point;
             out_count += 1;
@@ -295,111 +678,538 @@ static int reconstruct_path(
     const Grid& grid,
     const Location& start,
     const Location& goal,
-    const Location* came_from,
-    Location* out_path,
-    int max_path_length)
+    JpsPath* out_path)
 {
+    const int max_steps = grid.grid_size();
     Location current = goal;
-    int count = 0;
+    int count = 1;
 
-    while(1) {
-        if(count >= max_path_length) {
+    // First pass only counts, so the output is sized to the path itself.
+    while(current != start) {
+        Location parent = search_node(current).came_from;
+        if(parent == NoneLoc || count > max_steps) {
             return -1;
         }
-
-        out_path[count] = current;
+        current = parent;
         count += 1;
+    }
 
-        if(current == start) {
-            break;
+    if(!out_path->reserve(count)) {
+        return -1;
+    }
+
+    current = goal;
+    int i;
+    for(i = count - 1; i >= 0; --i) {
+        out_path->points[i] = current;
+        if(i > 0) {
+            current = search_node(current).came_from;
         }
+    }
+    out_path->size = count;
 
-        int index = grid.to_index(current);
-        Location parent = came_from[index];
-        if(parent == NoneLoc) {
-            return -1;
+    return count;
+}
+
+int jps_compact_path(Location* path, int count)
+{
+    if(count <= 2) {
+        return count;
+    }
+
+    int kept = 1;
+    int i;
+    for(i = 1; i < count - 1; ++i) {
+        const Location in = path[i] - path[kept - 1];
+        const Location out = path[i + 1] - path[i];
+        const bool collinear = (in.x * out.y - in.y * out.x) == 0
+            && (in.x * out.x + in.y * out.y) > 0;
+        if(!collinear) {
+            path[kept] = path[i];
+            ++kept;
         }
-        current = parent;
+    }
+    path[kept] = path[count - 1];
+    return kept + 1;
+}
+
+int jps_smooth_path(const Grid& grid, Location* path, int count, int clearance)
+{
+    if(count <= 2) {
+        return count;
     }
 
+    int kept = 1;
     int i;
-    for(i = 0; i < count / 2; ++i) {
-        Location temp = out_path[i];
-        out_path[i] = out_path[count - 1 - i];
-        out_path[count - 1 - i] = temp;
+    for(i = 1; i < count - 1; ++i) {
+        if(!grid.line_of_sight(path[kept - 1], path[i + 1], clearance)) {
+            path[kept] = path[i];
+            ++kept;
+        }
     }
+    path[kept] = path[count - 1];
+    return kept + 1;
+}
 
-    return count;
+// Whether an edit can change line_of_sight(a, b) for a unit reaching `reach`
+// cells right of and below its anchor. line_of_sight only tests anchors in
+// the end points' bounding box whose centres lie within one cell of the line.
+static inline bool segment_touches(const GridRect& edit, const Location& a, const Location& b, int reach)
+{
+    // Anchors whose unit covers an edited cell
+    const int x0 = edit.min_x - reach;
+    const int y0 = edit.min_y - reach;
+    const int x1 = edit.max_x;
+    const int y1 = edit.max_y;
+    if((x1 < a.x && x1 < b.x) || (x0 > a.x && x0 > b.x)
+        || (y1 < a.y && y1 < b.y) || (y0 > a.y && y0 > b.y)) {
+        return false;
+    }
+    // Does the line cross the anchor box grown by one cell?
+    const int64_t dx = b.x - a.x;
+    const int64_t dy = b.y - a.y;
+    const int64_t c00 = dx * (y0 - 1 - a.y) - dy * (x0 - 1 - a.x);
+    const int64_t c01 = dx * (y1 + 1 - a.y) - dy * (x0 - 1 - a.x);
+    const int64_t c10 = dx * (y0 - 1 - a.y) - dy * (x1 + 1 - a.x);
+    const int64_t c11 = dx * (y1 + 1 - a.y) - dy * (x1 + 1 - a.x);
+    return !((c00 > 0 && c01 > 0 && c10 > 0 && c11 > 0) || (c00 < 0 && c01 < 0 && c10 < 0 && c11 < 0));
+}
+
+int jps_validate_path(const Grid& grid, const Location* path, int count, unsigned int since_version, int clearance)
+{
+    if(count <= 0 || (since_version != 0 && since_version == grid.get_version())) {
+        return -1;
+    }
+    if(count == 1) {
+        return (grid.in_bounds(path[0]) && grid.passable(path[0], clearance)) ? -1 : 0;
+    }
+
+    // Only segments near an edit made since the path was found need a check;
+    // without a usable history every segment is checked.
+    GridRect edits[GRID_EDIT_HISTORY];
+    const int edit_count = (since_version != 0) ? grid.edits_since(since_version, edits, GRID_EDIT_HISTORY) : -1;
+    // A clearance unit reaches clearance - 1 cells right of and below its anchor.
+    const int reach = clearance - 1;
+    int i;
+    for(i = 0; i < count - 1; ++i) {
+        const Location& a = path[i];
+        const Location& b = path[i + 1];
+        if(edit_count >= 0) {
+            int e;
+            for(e = 0; e < edit_count && !segment_touches(edits[e], a, b, reach); ++e) {
+            }
+            if(e == edit_count) {
+                continue;
+            }
+        }
+        if(!grid.line_of_sight(a, b, clearance)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Remaining-cost estimate used for ordering; landmarks can only raise it.
+static inline double estimate(const JpsQuery& query, const Location& loc, const Location& goal)
+{
+    if(query.engine == JPS_ENGINE_DIJKSTRA) {
+        return 0.0;
+    }
+    double h = query.heuristic(loc, goal);
+    if(query.landmarks != 0) {
+        double alt = query.landmarks->estimate(loc, goal);
+        if(alt > h) {
+            h = alt;
+        }
+    }
+    return h;
+}
+
+// Smallest g + h among open nodes; a lower bound on the optimal cost as long
+// as improved nodes are reopened.
+static double open_lower_bound(const Location& goal, const JpsQuery& query)
+{
+    double lower_bound = DBL_MAX;
+    int i;
+    for(i = 0; i < g_priority_queue.size; ++i) {
+        const Location& loc = g_priority_queue.elements[i].loc;
+        const SearchNode& node = search_node(loc);
+        if(node.closed) {
+            continue;
+        }
+        double f = node.cost_so_far + estimate(query, loc, goal);
+        if(f < lower_bound) {
+            lower_bound = f;
+        }
+    }
+    return lower_bound;
+}
+
+// Adds an open node to the focal queue under `key` when its `f` is within
+// `bound`, otherwise parks it in the pending queue until the bound rises.
+static void focal_push(double f, double key, const Location& loc, double bound)
+{
+    if(f <= bound) {
+        pq_push(&g_focal_queue, key, loc);
+    }
+    else {
+        pq_push(&g_focal_pending, f, loc);
+    }
+}
+
+// Picks the next node for focal search. The open queue is ordered by g + h
+// and supplies the bound; the focal queue is ordered by g + w * h and
+// supplies the node. Pending nodes move into focal only as the bound rises,
+// so no entry is examined more than once. Returns false once the open list
+// is exhausted.
+static bool focal_pop(const Location& goal, const JpsQuery& query,
+    double weight, double* lower_bound, Location* out)
+{
+    while(!pq_is_empty(&g_priority_queue)) {
+        const PQElement& top = g_priority_queue.elements[0];
+        const SearchNode& node = search_node(top.loc);
+        double f = node.cost_so_far + estimate(query, top.loc, goal);
+        if(!node.closed && top.priority <= f + 1e-9) {
+            break;
+        }
+        pq_pop(&g_priority_queue, 0, 0);
+    }
+    if(pq_is_empty(&g_priority_queue)) {
+        return false;
+    }
+
+    // Landmark rounding may let f_min dip slightly; the bound never shrinks.
+    const double f_min = g_priority_queue.elements[0].priority;
+    if(f_min > *lower_bound) {
+        *lower_bound = f_min;
+    }
+    const double bound = weight * *lower_bound + 1e-9;
+
+    while(!pq_is_empty(&g_focal_pending) && g_focal_pending.elements[0].priority <= bound) {
+        double f;
+        Location loc;
+        pq_pop(&g_focal_pending, &f, &loc);
+        const SearchNode& node = search_node(loc);
+        double h = estimate(query, loc, goal);
+        // Entries superseded by a cheaper path were pushed again.
+        if(node.closed || f > node.cost_so_far + h + 1e-9) {
+            continue;
+        }
+        pq_push(&g_focal_queue, node.cost_so_far + weight * h, loc);
+    }
+
+    while(!pq_is_empty(&g_focal_queue)) {
+        Location loc;
+        pq_pop(&g_focal_queue, 0, &loc);
+        if(!search_node(loc).closed) {
+            *out = loc;
+            return true;
+        }
+    }
+
+    pq_pop(&g_priority_queue, 0, out);
+    return true;
+}
+
+// Sum of step costs along a reconstructed path
+static double path_cost(heuristic_fn* heuristic, const JpsPath* path, int count)
+{
+    double cost = 0.0;
+    int p;
+    for(p = 1; p < count; ++p) {
+        cost += heuristic(path->points[p - 1], path->points[p]);
+    }
+    return cost;
 }
 
 int jps_find_path(
     const Grid& grid,
     const Location& start, const Location& goal,
-    heuristic_fn heuristic,
-    Location* out_path,
-    int max_path_length)
+    const JpsQuery& query,
+    JpsPath* out_path,
+    JpsStats* out_stats)
 {
-    const int grid_size = grid.grid_size();
+    heuristic_fn* heuristic = query.heuristic;
+    const int clearance = query.clearance;
+    const double weight = 1.0 + (query.epsilon > 0.0 ? query.epsilon : 0.0);
+    // Bounded modes reopen closed nodes whose cost improves, which keeps the
+    // open-list lower bound valid for the reported suboptimality.
+    const bool bounded = weight > 1.0;
+    const bool focal = bounded && query.focal;
+    // Rounded landmark bounds may be slightly inconsistent; reopening keeps
+    // the search exact with them.
+    const bool reopen = bounded || query.landmarks != 0;
+    const bool limited = query.max_cost > 0.0 || query.max_radius > 0 || query.max_expansions > 0;
+
+    JpsStats stats;
+    stats.status = JPS_STATUS_NO_PATH;
+    double lower_bound = 0.0;
+
+    out_path->clear();
+    if(clearance > 1) {
+        if(!grid.supports_clearance()) {
+            if(out_stats != 0) {
+                *out_stats = stats;
+            }
+            return -1;
+        }
+        grid.ensure_clearance();
+    }
 
-    ensure_jps_buffers(grid_size);
-    reset_jps_buffers(grid_size);
+    search_reset(grid);
+    g_jump_memo.caching = true;
+    g_jump_memo.hits = 0;
+    g_jump_memo.misses = 0;
+    g_jump_memo.scanned = 0;
+    g_jump_box.active = query.max_radius > 0;
+    g_jump_box.hit = false;
+    g_jump_box.min_x = start.x - query.max_radius;
+    g_jump_box.min_y = start.y - query.max_radius;
+    g_jump_box.max_x = start.x + query.max_radius;
+    g_jump_box.max_y = start.y + query.max_radius;
 
     pq_reset(&g_priority_queue);
+    pq_reset(&g_focal_queue);
+    pq_reset(&g_focal_pending);
 
-    int start_idx = grid.to_index(start);
-    g_jps_buffers.came_from[start_idx] = start;
-    g_jps_buffers.cost_so_far[start_idx] = 0.0;
+    SearchNode& start_node = search_node(start);
+    start_node.came_from = start;
+    start_node.cost_so_far = 0.0;
 
     pq_push(&g_priority_queue, 0.0, start);
+    if(focal) {
+        pq_push(&g_focal_queue, weight * estimate(query, start, goal), start);
+    }
 
     Location parent = NoneLoc;
+    int path_len = -1;
+    // Closest expanded node to the goal, returned when a limit stops the search
+    Location best = start;
+    double best_h = heuristic(start, goal);
+    bool cost_limit_hit = false;
 
-    while(!pq_is_empty(&g_priority_queue)) {
-        double current_priority;
+    while(1) {
         Location current;
-        pq_pop(&g_priority_queue, &current_priority, &current);
+        if(focal) {
+            if(!focal_pop(goal, query, weight, &lower_bound, &current)) {
+                break;
+            }
+        }
+        else {
+            if(pq_is_empty(&g_priority_queue)) {
+                break;
+            }
+            pq_pop(&g_priority_queue, 0, &current);
+        }
 
-        int current_idx = grid.to_index(current);
-        if(g_jps_buffers.closed_set[current_idx]) {
+        SearchNode& current_node = search_node(current);
+        if(current_node.closed) {
             continue;
         }
-        g_jps_buffers.closed_set[current_idx] = 1;
+        current_node.closed = 1;
+        stats.expansions += 1;
 
         if(current == goal) {
-            int path_len = reconstruct_path(grid, start, goal, g_jps_buffers.came_from, out_path, max_path_length);
-            return path_len;
+            path_len = reconstruct_path(grid, start, goal, out_path);
+            stats.status = JPS_STATUS_FOUND;
+            // Reopening may have improved ancestors after the goal was
+            // reached, so the cost is summed along the reconstructed path.
+            stats.cost = path_cost(heuristic, out_path, path_len);
+            if(bounded) {
+                double open_bound = open_lower_bound(goal, query);
+                if(open_bound > lower_bound) {
+                    lower_bound = open_bound;
+                }
+                if(lower_bound > stats.cost) {
+                    lower_bound = stats.cost;
+                }
+                stats.suboptimality = (lower_bound > 0.0) ? stats.cost / lower_bound : 1.0;
+            }
+            break;
+        }
+
+        if(limited) {
+            double h = heuristic(current, goal);
+            if(h < best_h) {
+                best_h = h;
+                best = current;
+            }
+            if(query.max_expansions > 0 && stats.expansions >= query.max_expansions) {
+                stats.status = JPS_STATUS_EXPANSION_LIMIT;
+                break;
+            }
         }
 
         if(current != start) {
-            parent = g_jps_buffers.came_from[current_idx];
+            parent = current_node.came_from;
         }
         else {
             parent = NoneLoc;
         }
 
         Location next_nodes[JPS_MAX_NEIGHBOURS];
-        int next_count = successors(grid, current, parent, goal, next_nodes, JPS_MAX_NEIGHBOURS);
-
+        int next_count;
         int i;
+        if(query.engine == JPS_ENGINE_JPS) {
+            next_count = successors(grid, current, parent, goal, next_nodes, JPS_MAX_NEIGHBOURS, clearance);
+        }
+        else {
+            next_count = grid.pruned_neighbours(current, NoneLoc, next_nodes, JPS_MAX_NEIGHBOURS, clearance);
+            if(g_jump_box.active) {
+                int kept = 0;
+                for(i = 0; i < next_count; ++i) {
+                    if(jump_box_contains(next_nodes[i])) {
+                        next_nodes[kept++] = next_nodes[i];
+                    }
+                }
+                next_count = kept;
+            }
+        }
+
         for(i = 0; i < next_count; ++i) {
             const Location& next = next_nodes[i];
-            int next_idx = grid.to_index(next);
+            SearchNode& next_node = search_node(next);
 
-            if(g_jps_buffers.closed_set[next_idx]) {
+            if(next_node.closed && !reopen) {
                 continue;
             }
 
-            double new_cost = g_jps_buffers.cost_so_far[current_idx] + heuristic(current, next);
-            double existing_cost = g_jps_buffers.cost_so_far[next_idx];
+            double new_cost = current_node.cost_so_far + heuristic(current, next);
+            if(query.max_cost > 0.0 && new_cost > query.max_cost) {
+                cost_limit_hit = true;
+                continue;
+            }
+            double existing_cost = next_node.cost_so_far;
 
             if(existing_cost == DBL_MAX || new_cost < existing_cost) {
-                g_jps_buffers.cost_so_far[next_idx] = new_cost;
-                g_jps_buffers.came_from[next_idx] = current;
-                double priority = new_cost + heuristic(next, goal);
-                pq_push(&g_priority_queue, priority, next);
+                next_node.cost_so_far = new_cost;
+                next_node.came_from = current;
+                next_node.closed = 0;
+                double h = estimate(query, next, goal);
+                if(focal) {
+                    pq_push(&g_priority_queue, new_cost + h, next);
+                    focal_push(new_cost + h, new_cost + weight * h, next, weight * lower_bound + 1e-9);
+                }
+                else {
+                    pq_push(&g_priority_queue, new_cost + weight * h, next);
+                }
             }
         }
     }
 
-    return -1;
+    if(path_len < 0 && limited) {
+        // Hand back the way to the closest node found instead of nothing.
+        if(stats.status != JPS_STATUS_EXPANSION_LIMIT) {
+            if(cost_limit_hit) {
+                stats.status = JPS_STATUS_COST_LIMIT;
+            }
+            else if(g_jump_box.hit) {
+                stats.status = JPS_STATUS_RADIUS_LIMIT;
+            }
+        }
+        path_len = reconstruct_path(grid, start, best, out_path);
+        stats.cost = path_cost(heuristic, out_path, path_len);
+    }
+
+    g_jump_memo.caching = false;
+    g_jump_box.active = false;
+    stats.jump_cache_hits = g_jump_memo.hits;
+    stats.jump_cache_misses = g_jump_memo.misses;
+    stats.scanned_cells = g_jump_memo.scanned;
+
+    if(g_memory_budget > 0 && jps_memory_bytes() > g_memory_budget) {
+        jps_trim(g_memory_budget);
+    }
+
+    if(out_stats != 0) {
+        *out_stats = stats;
+    }
+    return path_len;
+}
+
+// Small deterministic generator so calibration samples are reproducible
+static unsigned int calibration_random(unsigned int* state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+JpsEngine jps_calibrate(const Grid& grid, int query_count, int max_radius, JpsCalibration* out)
+{
+    JpsCalibration result;
+    const int width = grid.get_width();
+    const int height = grid.get_height();
+    unsigned int state = 12345u;
+    if(width <= 0 || height <= 0 || query_count <= 0) {
+        if(out != 0) {
+            *out = result;
+        }
+        return result.best;
+    }
+    if(query_count > JPS_CALIBRATE_MAX_QUERIES) {
+        query_count = JPS_CALIBRATE_MAX_QUERIES;
+    }
+    // Offsets wider than the grid only produce out of bounds goals.
+    if(max_radius > width + height) {
+        max_radius = width + height;
+    }
+
+    const int density_samples = 4096;
+    int blocked = 0;
+    int i;
+    for(i = 0; i < density_samples; ++i) {
+        Location loc = make_location((int)(calibration_random(&state) % (unsigned int)width),
+            (int)(calibration_random(&state) % (unsigned int)height));
+        if(!grid.passable(loc)) {
+            blocked += 1;
+        }
+    }
+    result.density = (double)blocked / density_samples;
+
+    // Pick the sample queries once so every engine runs the same set.
+    Location* pairs = new Location[query_count * 2];
+    int pair_count = 0;
+    int attempts;
+    for(attempts = 0; attempts < query_count * 32 && pair_count < query_count; ++attempts) {
+        Location start = make_location((int)(calibration_random(&state) % (unsigned int)width),
+            (int)(calibration_random(&state) % (unsigned int)height));
+        Location goal;
+        if(max_radius > 0) {
+            const unsigned int span = (unsigned int)(max_radius * 2 + 1);
+            goal = make_location(start.x - max_radius + (int)(calibration_random(&state) % span),
+                start.y - max_radius + (int)(calibration_random(&state) % span));
+        }
+        else {
+            goal = make_location((int)(calibration_random(&state) % (unsigned int)width),
+                (int)(calibration_random(&state) % (unsigned int)height));
+        }
+        if(!grid.passable(start) || !grid.passable(goal) || start == goal) {
+            continue;
+        }
+        pairs[pair_count * 2] = start;
+        pairs[pair_count * 2 + 1] = goal;
+        pair_count += 1;
+    }
+    result.queries = pair_count;
+
+    JpsPath path;
+    int engine;
+    for(engine = 0; engine < JPS_ENGINE_COUNT; ++engine) {
+        JpsQuery query;
+        query.engine = (JpsEngine)engine;
+        const uint64_t started = Tool::now_microseconds();
+        for(i = 0; i < pair_count; ++i) {
+            jps_find_path(grid, pairs[i * 2], pairs[i * 2 + 1], query, &path);
+        }
+        result.microseconds[engine] = Tool::now_microseconds() - started;
+        if(result.microseconds[engine] < result.microseconds[result.best]) {
+            result.best = (JpsEngine)engine;
+        }
+    }
+    delete[] pairs;
+
+    if(out != 0) {
+        *out = result;
+    }
+    return result.best;
 }
@@ -1,21 +1,219 @@
 #pragma once
 
 #include "grid.hpp"
+#include "landmarks.hpp"
+#include "tools.hpp"
 
 typedef double(heuristic_fn)(const Location&, const Location&);
 
+// Search engines sharing the grid, search state and path output
+enum JpsEngine
+{
+    // Jump point search: expands jump points only; best on open maps.
+    JPS_ENGINE_JPS = 0,
+    // A* over all eight neighbours; wins on cluttered maps where jumps are short.
+    JPS_ENGINE_ASTAR,
+    // Uniform-cost search without a heuristic; cheapest per node for short queries.
+    JPS_ENGINE_DIJKSTRA,
+    JPS_ENGINE_COUNT
+};
+
+// Per-query search settings
+struct JpsQuery
+{
+    JpsEngine engine;
+    heuristic_fn* heuristic;
+    // Side of the square unit being moved; cells where it does not fit are
+    // treated as blocked. Limited to GRID_MAX_CLEARANCE.
+    int clearance;
+    // Bounded-suboptimal search: nodes are ordered by g + (1 + epsilon) * h,
+    // so the returned path costs at most (1 + epsilon) times the optimum.
+    double epsilon;
+    // With epsilon > 0, use a focal list instead: among open nodes with
+    // g + h <= (1 + epsilon) * min(g + h), expand the one closest to the goal.
+    bool focal;
+    // Optional ALT tables for the searched grid. The estimate becomes the
+    // larger of the heuristic and the landmark bound, and improved closed
+    // nodes are reopened since the rounded bound is not strictly consistent.
+    const LandmarkTable* landmarks;
+    // Search limits, 0 = unlimited. Nodes costing more than max_cost and cells
+    // more than max_radius steps (in x or y) from the start are not searched;
+    // the search stops after max_expansions expansions. When any limit is set
+    // and the goal is not reached, the path to the expanded node closest to
+    // the goal is returned and JpsStats::status tells why.
+    double max_cost;
+    int max_radius;
+    int max_expansions;
+
+    JpsQuery()
+        : engine(JPS_ENGINE_JPS)
+        , heuristic(Tool::octile)
+        , clearance(1)
+        , epsilon(0.0)
+        , focal(false)
+        , landmarks(0)
+        , max_cost(0.0)
+        , max_radius(0)
+        , max_expansions(0)
+    {
+    }
+};
+
+enum JpsStatus
+{
+    JPS_STATUS_FOUND = 0,
+    // The goal cannot be reached; with limits set, the path leads to the
+    // closest node found instead.
+    JPS_STATUS_NO_PATH,
+    // A limit pruned or stopped the search; the path is partial.
+    JPS_STATUS_COST_LIMIT,
+    JPS_STATUS_RADIUS_LIMIT,
+    JPS_STATUS_EXPANSION_LIMIT
+};
+
+// Per-query results reported alongside the path
+struct JpsStats
+{
+    JpsStatus status;
+    int expansions;
+    double cost;
+    // Proven ratio between the returned cost and the optimal cost: the cost
+    // divided by the best lower bound seen on the open list. 1.0 when exact.
+    double suboptimality;
+    // Cardinal jump scans answered from the per-query memo, scans that ran
+    // to their end, and cells stepped over by all scans.
+    int jump_cache_hits;
+    int jump_cache_misses;
+    int scanned_cells;
+
+    JpsStats()
+        : status(JPS_STATUS_NO_PATH)
+        , expansions(0)
+        , cost(0.0)
+        , suboptimality(1.0)
+        , jump_cache_hits(0)
+        , jump_cache_misses(0)
+        , scanned_cells(0)
+    {
+    }
+};
+
+// Growable path storage. Sized to the reconstructed path, never to the grid.
+struct JpsPath
+{
+    Location* points;
+    int size;
+    int capacity;
+
+    JpsPath();
+    ~JpsPath();
+
+    bool reserve(int required);
+    void clear() { size = 0; }
+    void release();
+    size_t memory_bytes() const { return (size_t)capacity * sizeof(Location); }
+
+private:
+    // Disable copying
+    JpsPath(const JpsPath&);
+    JpsPath& operator=(const JpsPath&);
+};
+
+// Walks a waypoint path cell by cell without materialising the expanded path.
+// Each segment is traced as an 8-connected line, so straight and diagonal
+// jump-point segments expand to exactly the cells the search moved through.
+struct PathCursor
+{
+    const Location* waypoints;
+    int count;
+    int segment;
+    int step;
+
+    PathCursor() : waypoints(0), count(0), segment(0), step(0) {}
+
+    void reset(const Location* waypoints_, int count_);
+    bool done() const;
+    int next_cells(Location* out, int max_count);
+};
+
 Location jump(const Grid& grid, const Location initial, const Location dir,
-    const Location goal);
+    const Location goal, int clearance = 1);
 
 int successors(const Grid& grid, const Location& current,
     const Location& parent, const Location& goal,
-    Location* out, int max_count);
+    Location* out, int max_count, int clearance = 1);
 
 int jps_find_path(
     const Grid& grid,
     const Location& start, const Location& goal,
-    heuristic_fn heuristic,
-    Location* out_path,
-    int max_path_length);
+    const JpsQuery& query,
+    JpsPath* out_path,
+    JpsStats* out_stats = 0);
+
+// Result of timing every engine on the same sample queries
+struct JpsCalibration
+{
+    // Fraction of sampled cells that are blocked
+    double density;
+    int queries;
+    uint64_t microseconds[JPS_ENGINE_COUNT];
+    JpsEngine best;
+
+    JpsCalibration() : density(0.0), queries(0), best(JPS_ENGINE_JPS)
+    {
+        int i;
+        for(i = 0; i < JPS_ENGINE_COUNT; ++i) {
+            microseconds[i] = 0;
+        }
+    }
+};
+
+// Upper bound on calibration samples; larger counts are clamped.
+#define JPS_CALIBRATE_MAX_QUERIES 4096
+
+// Runs `query_count` random queries with every engine and picks the fastest.
+// With max_radius > 0 goals lie within that octile distance of the start, to
+// match the typical query length. With max_radius == 0 goals are anywhere,
+// so each Dijkstra sample typically explores most of the grid. The sampling
+// is deterministic.
+JpsEngine jps_calibrate(const Grid& grid, int query_count, int max_radius, JpsCalibration* out);
+
+// Drops jump points that lie on a straight continuation of the previous
+// segment. Returns the new point count.
+int jps_compact_path(Location* path, int count);
+
+// String pulling: removes every waypoint whose neighbours can see each other
+// in a straight line. Returns the new point count.
+int jps_smooth_path(const Grid& grid, Location* path, int count, int clearance = 1);
+
+// Checks that every segment of a path (jump points, waypoints or a smoothed
+// path) is still walkable. With since_version != 0 the path is taken to have
+// been valid at that grid version, and only segments near edits made since
+// are checked. Returns the index of the first blocked segment, which runs
+// from path[i] to path[i + 1], or -1 when the path is valid.
+int jps_validate_path(const Grid& grid, const Location* path, int count,
+    unsigned int since_version = 0, int clearance = 1);
+
+// Memory pooled by the search between queries
+struct JpsMemoryStats
+{
+    // Search pages kept for reuse and the bytes they hold
+    int pages;
+    size_t page_bytes;
+    // Page table and page bookkeeping
+    size_t table_bytes;
+    // Open and focal queues
+    size_t queue_bytes;
+};
+
+void jps_memory_stats(JpsMemoryStats* out);
+size_t jps_memory_bytes();
+// Frees pooled search memory until at most max_bytes remain. Returns the
+// number of bytes freed.
+size_t jps_trim(size_t max_bytes);
+// Pooled search memory above the budget is freed after every query, so one
+// large search does not pin its peak. 0 (the default) keeps everything.
+void jps_set_memory_budget(size_t max_bytes);
+size_t jps_get_memory_budget();
 
 void jps_shutdown();
@@ -0,0 +1,331 @@
+#include "landmarks.hpp"
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// Straight and diagonal step costs in thousandths, matching Tool::octile.
+#define LANDMARK_STRAIGHT_COST 1000u
+#define LANDMARK_DIAGONAL_COST 1414u
+
+static const double LANDMARK_PI = 3.14159265358979323846;
+
+static const unsigned int LANDMARK_MAGIC = 0x4c53504a; // "JPSL"
+static const unsigned int LANDMARK_VERSION = 1;
+
+static const Location LANDMARK_DIRS[8] = {
+    {1, 0}, {-1, 0}, {0, 1}, {0, -1},
+    {1, 1}, {-1, 1}, {1, -1}, {-1, -1}
+};
+
+struct LandmarkHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    int width;
+    int height;
+    int count;
+    unsigned int map_hash;
+};
+
+unsigned int landmark_map_hash(const Grid& grid)
+{
+    // FNV-1a over one bit per cell, packed into bytes
+    unsigned int hash = 2166136261u;
+    const int size = grid.grid_size();
+    unsigned int bits = 0;
+    int i;
+    for(i = 0; i < size; ++i) {
+        bits = (bits << 1) | (grid.passable(grid.from_index(i)) ? 1u : 0u);
+        if((i & 7) == 7 || i == size - 1) {
+            hash = (hash ^ (bits & 0xff)) * 16777619u;
+            bits = 0;
+        }
+    }
+    return hash;
+}
+
+LandmarkTable::LandmarkTable()
+    : width(0)
+    , height(0)
+    , count(0)
+    , distances(0)
+    , map_hash(0)
+{
+}
+
+LandmarkTable::~LandmarkTable()
+{
+    release();
+}
+
+void LandmarkTable::release()
+{
+    if(distances != 0) {
+        delete[] distances;
+        distances = 0;
+    }
+    width = 0;
+    height = 0;
+    count = 0;
+    map_hash = 0;
+}
+
+int LandmarkTable::prepare(const Grid& grid, int count_)
+{
+    release();
+    if(!grid.is_flat() || count_ <= 0) {
+        return 0;
+    }
+    if(count_ > LANDMARK_MAX_COUNT) {
+        count_ = LANDMARK_MAX_COUNT;
+    }
+
+    // The passable cell farthest from the centre in each angular sector.
+    const int w = grid.get_width();
+    const int h = grid.get_height();
+    const double cx = (w - 1) * 0.5;
+    const double cy = (h - 1) * 0.5;
+    double best_distance[LANDMARK_MAX_COUNT];
+    Location best[LANDMARK_MAX_COUNT];
+    int i;
+    for(i = 0; i < count_; ++i) {
+        best_distance[i] = -1.0;
+    }
+
+    int x, y;
+    for(y = 0; y < h; ++y) {
+        for(x = 0; x < w; ++x) {
+            const Location loc = make_location(x, y);
+            if(!grid.passable(loc)) {
+                continue;
+            }
+            const double dx = x - cx;
+            const double dy = y - cy;
+            int sector = (int)((atan2(dy, dx) + LANDMARK_PI) / (2.0 * LANDMARK_PI) * count_);
+            if(sector >= count_) {
+                sector = count_ - 1;
+            }
+            const double distance = dx * dx + dy * dy;
+            if(distance > best_distance[sector]) {
+                best_distance[sector] = distance;
+                best[sector] = loc;
+            }
+        }
+    }
+
+    int picked = 0;
+    for(i = 0; i < count_; ++i) {
+        if(best_distance[i] >= 0.0) {
+            best[picked++] = best[i];
+        }
+    }
+    return prepare_at(grid, best, picked);
+}
+
+int LandmarkTable::prepare_at(const Grid& grid, const Location* points, int count_)
+{
+    release();
+    if(!grid.is_flat()) {
+        return 0;
+    }
+    int picked = 0;
+    int i;
+    for(i = 0; i < count_ && picked < LANDMARK_MAX_COUNT; ++i) {
+        if(grid.in_bounds(points[i]) && grid.passable(points[i])) {
+            landmarks[picked] = points[i];
+            units[picked] = 1;
+            ++picked;
+        }
+    }
+    if(picked == 0) {
+        return 0;
+    }
+
+    width = grid.get_width();
+    height = grid.get_height();
+    count = picked;
+    distances = new unsigned short[(size_t)count * width * height];
+    map_hash = landmark_map_hash(grid);
+    return count;
+}
+
+// Binary min-heap of (distance << 32 | cell) keys
+struct LandmarkHeap
+{
+    uint64_t* keys;
+    int size;
+    int capacity;
+
+    LandmarkHeap() : keys(0), size(0), capacity(0) {}
+    ~LandmarkHeap() { delete[] keys; }
+
+    void push(uint64_t key)
+    {
+        if(size == capacity) {
+            int new_capacity = capacity ? capacity * 2 : 1024;
+            uint64_t* new_keys = new uint64_t[new_capacity];
+            if(keys != 0) {
+                memcpy(new_keys, keys, size * sizeof(uint64_t));
+                delete[] keys;
+            }
+            keys = new_keys;
+            capacity = new_capacity;
+        }
+        int index = size++;
+        while(index > 0) {
+            int parent = (index - 1) / 2;
+            if(keys[parent] <= key) {
+                break;
+            }
+            keys[index] = keys[parent];
+            index = parent;
+        }
+        keys[index] = key;
+    }
+
+    uint64_t pop()
+    {
+        uint64_t result = keys[0];
+        uint64_t last = keys[--size];
+        int index = 0;
+        while(1) {
+            int child = index * 2 + 1;
+            if(child >= size) {
+                break;
+            }
+            if(child + 1 < size && keys[child + 1] < keys[child]) {
+                child += 1;
+            }
+            if(last <= keys[child]) {
+                break;
+            }
+            keys[index] = keys[child];
+            index = child;
+        }
+        if(size > 0) {
+            keys[index] = last;
+        }
+        return result;
+    }
+
+private:
+    // Disable copying
+    LandmarkHeap(const LandmarkHeap&);
+    LandmarkHeap& operator=(const LandmarkHeap&);
+};
+
+void LandmarkTable::compute(const Grid& grid, int index)
+{
+    const size_t cells = (size_t)width * height;
+    unsigned int* exact = new unsigned int[cells];
+    size_t i;
+    for(i = 0; i < cells; ++i) {
+        exact[i] = UINT_MAX;
+    }
+
+    LandmarkHeap heap;
+    const int source = grid.to_index(landmarks[index]);
+    exact[source] = 0;
+    heap.push((uint64_t)source);
+
+    unsigned int longest = 0;
+    while(heap.size > 0) {
+        const uint64_t key = heap.pop();
+        const unsigned int distance = (unsigned int)(key >> 32);
+        const int cell = (int)(key & 0xffffffffu);
+        if(distance > exact[cell]) {
+            continue;
+        }
+        longest = distance;
+
+        const Location loc = grid.from_index(cell);
+        int d;
+        for(d = 0; d < 8; ++d) {
+            const Location& dir = LANDMARK_DIRS[d];
+            if(!grid.valid_move(loc, dir)) {
+                continue;
+            }
+            const unsigned int step = (d < 4) ? LANDMARK_STRAIGHT_COST : LANDMARK_DIAGONAL_COST;
+            if(distance > UINT_MAX - step) {
+                continue;
+            }
+            const int next = grid.to_index(loc + dir);
+            if(distance + step < exact[next]) {
+                exact[next] = distance + step;
+                heap.push(((uint64_t)(distance + step) << 32) | (uint64_t)next);
+            }
+        }
+    }
+
+    // Quantise so the longest distance still fits below the unreachable marker.
+    const unsigned int unit = longest / (LANDMARK_UNREACHABLE - 1) + 1;
+    units[index] = unit;
+    unsigned short* row = distances + index * cells;
+    for(i = 0; i < cells; ++i) {
+        row[i] = (exact[i] == UINT_MAX) ? (unsigned short)LANDMARK_UNREACHABLE : (unsigned short)(exact[i] / unit);
+    }
+    delete[] exact;
+}
+
+size_t LandmarkTable::save_size() const
+{
+    return sizeof(LandmarkHeader)
+        + (size_t)count * (sizeof(Location) + sizeof(unsigned int))
+        + memory_bytes();
+}
+
+void LandmarkTable::save(unsigned char* out) const
+{
+    LandmarkHeader header;
+    header.magic = LANDMARK_MAGIC;
+    header.version = LANDMARK_VERSION;
+    header.width = width;
+    header.height = height;
+    header.count = count;
+    header.map_hash = map_hash;
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    memcpy(out, landmarks, count * sizeof(Location));
+    out += count * sizeof(Location);
+    memcpy(out, units, count * sizeof(unsigned int));
+    out += count * sizeof(unsigned int);
+    memcpy(out, distances, memory_bytes());
+}
+
+bool LandmarkTable::load(const Grid& grid, const unsigned char* data, size_t size)
+{
+    LandmarkHeader header;
+    if(!grid.is_flat() || size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if(header.magic != LANDMARK_MAGIC || header.version != LANDMARK_VERSION
+        || header.width != grid.get_width() || header.height != grid.get_height()
+        || header.count <= 0 || header.count > LANDMARK_MAX_COUNT) {
+        return false;
+    }
+    const size_t cells = (size_t)header.width * header.height;
+    const size_t expected = sizeof(header)
+        + (size_t)header.count * (sizeof(Location) + sizeof(unsigned int))
+        + (size_t)header.count * cells * sizeof(unsigned short);
+    if(size != expected || header.map_hash != landmark_map_hash(grid)) {
+        return false;
+    }
+
+    release();
+    data += sizeof(header);
+    memcpy(landmarks, data, header.count * sizeof(Location));
+    data += header.count * sizeof(Location);
+    memcpy(units, data, header.count * sizeof(unsigned int));
+    data += header.count * sizeof(unsigned int);
+    distances = new unsigned short[header.count * cells];
+    memcpy(distances, data, header.count * cells * sizeof(unsigned short));
+
+    width = header.width;
+    height = header.height;
+    count = header.count;
+    map_hash = header.map_hash;
+    return true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "grid.hpp"
+
+#include <stddef.h>
+
+#define LANDMARK_MAX_COUNT 32
+#define LANDMARK_UNREACHABLE 0xFFFF
+
+// Differential heuristic (ALT) tables: the exact 8-connected distance from K
+// landmark cells to every cell. By the triangle inequality |d(L, a) - d(L, b)|
+// never exceeds the distance between a and b, so the largest difference over
+// all landmarks is an admissible estimate that sees walls, unlike octile.
+//
+// Distances are stored as 16-bit values in per-landmark units. Rounding can
+// overstate a difference by at most one unit, so one unit is subtracted.
+class LandmarkTable
+{
+private:
+    int width;
+    int height;
+    int count;
+    Location landmarks[LANDMARK_MAX_COUNT];
+    // Size of one stored step, in thousandths of a cell.
+    unsigned int units[LANDMARK_MAX_COUNT];
+    // One row of width * height distances per landmark.
+    unsigned short* distances;
+    // Hash of the walls the tables were computed for.
+    unsigned int map_hash;
+
+    // Disable copying
+    LandmarkTable(const LandmarkTable&);
+    LandmarkTable& operator=(const LandmarkTable&);
+
+public:
+    LandmarkTable();
+    ~LandmarkTable();
+
+    void release();
+
+    // Spreads up to `count_` landmarks over the map edge, one per angular
+    // sector around the centre, and allocates their rows. Only flat grids are
+    // supported. Returns the number of landmarks picked.
+    int prepare(const Grid& grid, int count_);
+    // Same, with the landmarks given; blocked or out of bounds points are
+    // skipped.
+    int prepare_at(const Grid& grid, const Location* points, int count_);
+    // Runs a Dijkstra from one landmark and fills its row. Calls for
+    // different indices touch disjoint memory and may run in parallel.
+    void compute(const Grid& grid, int index);
+
+    // Serialised form: a header, the landmarks and the rows, in native byte
+    // order. load() rejects data computed for different walls.
+    size_t save_size() const;
+    void save(unsigned char* out) const;
+    bool load(const Grid& grid, const unsigned char* data, size_t size);
+
+    bool ready() const { return count > 0; }
+    int get_count() const { return count; }
+    const Location& get_landmark(int index) const { return landmarks[index]; }
+    size_t memory_bytes() const { return (size_t)count * width * height * sizeof(unsigned short); }
+
+    inline double estimate(const Location& a, const Location& b) const
+    {
+        const size_t cells = (size_t)width * height;
+        const int index_a = a.y * width + a.x;
+        const int index_b = b.y * width + b.x;
+        unsigned int best = 0;
+        int i;
+        for(i = 0; i < count; ++i) {
+            const unsigned short* row = distances + i * cells;
+            const int da = row[index_a];
+            const int db = row[index_b];
+            if(da == LANDMARK_UNREACHABLE || db == LANDMARK_UNREACHABLE) {
+                continue;
+            }
+            const int diff = (da > db ? da - db : db - da) - 1;
+            if(diff > 0 && (unsigned int)diff * units[i] > best) {
+                best = (unsigned int)diff * units[i];
+            }
+        }
+        return best / 1000.0;
+    }
+};
+
+// Hash of the passable cells, used to match saved tables to a map.
+unsigned int landmark_map_hash(const Grid& grid);
@@ -0,0 +1,157 @@
+#include "overlay.hpp"
+
+#include <limits.h>
+
+static inline unsigned int hash_tile(int tx, int ty)
+{
+    return (unsigned int)tx * 73856093u ^ (unsigned int)ty * 19349663u;
+}
+
+OverlayTiles::OverlayTiles()
+    : slots(0)
+    , capacity(0)
+    , count(0)
+    , min_x(INT_MAX)
+    , min_y(INT_MAX)
+    , max_x(INT_MIN)
+    , max_y(INT_MIN)
+    , last_tile(0)
+{
+}
+
+OverlayTiles::~OverlayTiles()
+{
+    clear();
+    if(slots != 0) {
+        delete[] slots;
+        slots = 0;
+    }
+    capacity = 0;
+}
+
+void OverlayTiles::clear()
+{
+    int i;
+    for(i = 0; i < capacity && count > 0; ++i) {
+        if(slots[i] != 0) {
+            delete slots[i];
+            slots[i] = 0;
+            count -= 1;
+        }
+    }
+    count = 0;
+    min_x = INT_MAX;
+    min_y = INT_MAX;
+    max_x = INT_MIN;
+    max_y = INT_MIN;
+    last_tile = 0;
+}
+
+const OverlayTiles::Tile* OverlayTiles::find(int tx, int ty) const
+{
+    if(count == 0) {
+        return 0;
+    }
+    const int mask = capacity - 1;
+    int index = (int)(hash_tile(tx, ty) & (unsigned int)mask);
+    while(slots[index] != 0) {
+        if(slots[index]->tx == tx && slots[index]->ty == ty) {
+            return slots[index];
+        }
+        index = (index + 1) & mask;
+    }
+    return 0;
+}
+
+bool OverlayTiles::tiles_in(int x0, int y0, int x1, int y1) const
+{
+    if(count == 0 || x1 < min_x || x0 > max_x || y1 < min_y || y0 > max_y) {
+        return false;
+    }
+    const int tx1 = x1 >> OVERLAY_TILE_SHIFT;
+    const int ty1 = y1 >> OVERLAY_TILE_SHIFT;
+    int ty;
+    for(ty = y0 >> OVERLAY_TILE_SHIFT; ty <= ty1; ++ty) {
+        int tx;
+        for(tx = x0 >> OVERLAY_TILE_SHIFT; tx <= tx1; ++tx) {
+            if(find(tx, ty) != 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void OverlayTiles::grow()
+{
+    const int old_capacity = capacity;
+    Tile** old_slots = slots;
+
+    capacity = (old_capacity == 0) ? 8 : old_capacity * 2;
+    slots = new Tile*[capacity];
+    int i;
+    for(i = 0; i < capacity; ++i) {
+        slots[i] = 0;
+    }
+
+    const int mask = capacity - 1;
+    for(i = 0; i < old_capacity; ++i) {
+        Tile* tile = old_slots[i];
+        if(tile == 0) {
+            continue;
+        }
+        int index = (int)(hash_tile(tile->tx, tile->ty) & (unsigned int)mask);
+        while(slots[index] != 0) {
+            index = (index + 1) & mask;
+        }
+        slots[index] = tile;
+    }
+
+    if(old_slots != 0) {
+        delete[] old_slots;
+    }
+}
+
+void OverlayTiles::set(int x, int y, bool blocked)
+{
+    const int tx = x >> OVERLAY_TILE_SHIFT;
+    const int ty = y >> OVERLAY_TILE_SHIFT;
+    Tile* tile = (Tile*)find(tx, ty);
+
+    if(tile == 0) {
+        if((count + 1) * 2 > capacity) {
+            grow();
+        }
+        tile = new Tile;
+        tile->tx = tx;
+        tile->ty = ty;
+        int w;
+        for(w = 0; w < OVERLAY_TILE_WORDS; ++w) {
+            tile->overridden[w] = 0;
+            tile->blocked[w] = 0;
+        }
+
+        const int mask = capacity - 1;
+        int index = (int)(hash_tile(tx, ty) & (unsigned int)mask);
+        while(slots[index] != 0) {
+            index = (index + 1) & mask;
+        }
+        slots[index] = tile;
+        count += 1;
+    }
+
+    const int bit = ((y & OVERLAY_TILE_MASK) << OVERLAY_TILE_SHIFT) | (x & OVERLAY_TILE_MASK);
+    const unsigned int mask = 1u << (bit & 31);
+    tile->overridden[bit >> 5] |= mask;
+    if(blocked) {
+        tile->blocked[bit >> 5] |= mask;
+    }
+    else {
+        tile->blocked[bit >> 5] &= ~mask;
+    }
+
+    if(x < min_x) { min_x = x; }
+    if(y < min_y) { min_y = y; }
+    if(x > max_x) { max_x = x; }
+    if(y > max_y) { max_y = y; }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stddef.h>
+
+// Per-cell overrides layered over a base grid. Only OVERLAY_TILE_SIZE x
+// OVERLAY_TILE_SIZE tiles containing edited cells are stored, in an
+// open-addressed hash keyed by tile coordinates, so creating, editing and
+// clearing an overlay costs O(changed cells).
+#define OVERLAY_TILE_SHIFT 4
+#define OVERLAY_TILE_SIZE (1 << OVERLAY_TILE_SHIFT)
+#define OVERLAY_TILE_MASK (OVERLAY_TILE_SIZE - 1)
+#define OVERLAY_TILE_WORDS ((OVERLAY_TILE_SIZE * OVERLAY_TILE_SIZE) / 32)
+
+class OverlayTiles
+{
+private:
+    struct Tile
+    {
+        int tx;
+        int ty;
+        // Bit set when the cell is overridden, and the overriding value.
+        unsigned int overridden[OVERLAY_TILE_WORDS];
+        unsigned int blocked[OVERLAY_TILE_WORDS];
+    };
+
+    Tile** slots;
+    int capacity;
+    int count;
+
+    // Bounding box of overridden cells; lookups outside it skip the hash.
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+
+    // Scans are local, so the last tile found answers most lookups.
+    mutable const Tile* last_tile;
+
+    const Tile* find(int tx, int ty) const;
+    void grow();
+
+    // Disable copying
+    OverlayTiles(const OverlayTiles&);
+    OverlayTiles& operator=(const OverlayTiles&);
+
+public:
+    OverlayTiles();
+    ~OverlayTiles();
+
+    void clear();
+
+    // -1 when the cell is not overridden, otherwise 1 for blocked, 0 for open.
+    inline int lookup(int x, int y) const
+    {
+        if(x < min_x || x > max_x || y < min_y || y > max_y) {
+            return -1;
+        }
+        const int tx = x >> OVERLAY_TILE_SHIFT;
+        const int ty = y >> OVERLAY_TILE_SHIFT;
+        const Tile* tile = last_tile;
+        if(tile == 0 || tile->tx != tx || tile->ty != ty) {
+            tile = find(tx, ty);
+            if(tile == 0) {
+                return -1;
+            }
+            last_tile = tile;
+        }
+        const int bit = ((y & OVERLAY_TILE_MASK) << OVERLAY_TILE_SHIFT) | (x & OVERLAY_TILE_MASK);
+        const unsigned int mask = 1u << (bit & 31);
+        if((tile->overridden[bit >> 5] & mask) == 0) {
+            return -1;
+        }
+        return (tile->blocked[bit >> 5] & mask) != 0 ? 1 : 0;
+    }
+
+    void set(int x, int y, bool blocked);
+    bool row_overlaps(int y, int x0, int x1) const { return count > 0 && y >= min_y && y <= max_y && x1 >= min_x && x0 <= max_x; }
+    // True when a stored tile intersects the cells x0..x1, y0..y1 (inclusive).
+    bool tiles_in(int x0, int y0, int x1, int y1) const;
+
+    int tile_count() const { return count; }
+    size_t memory_bytes() const { return (size_t)capacity * sizeof(Tile*) + (size_t)count * sizeof(Tile); }
+};
@@ -0,0 +1,669 @@
+#include "recorder.hpp"
+
+#include <string.h>
+
+static const unsigned int QUERY_LOG_MAGIC = 0x5253504a; // "JPSR"
+static const unsigned int QUERY_LOG_VERSION = 2;
+
+// Layout byte of GRID records
+enum { QUERY_LOG_FLAT = 0, QUERY_LOG_CHUNKED = 1 };
+
+int query_log_heuristic_id(heuristic_fn* heuristic)
+{
+    if(heuristic == Tool::manhattan) {
+        return 1;
+    }
+    if(heuristic == Tool::euclidean) {
+        return 2;
+    }
+    return 0;
+}
+
+heuristic_fn* query_log_heuristic(int id)
+{
+    switch(id) {
+        case 1: return Tool::manhattan;
+        case 2: return Tool::euclidean;
+        default: return Tool::octile;
+    }
+}
+
+// Grows `buffer` to at least `count` entries, keeping the first `keep`
+template<typename T>
+static void reserve_buffer(T** buffer, int* capacity, int count, int keep)
+{
+    if(count <= *capacity) {
+        return;
+    }
+    int new_capacity = (*capacity > 0) ? *capacity : 64;
+    while(new_capacity < count) {
+        new_capacity *= 2;
+    }
+    T* grown = new T[new_capacity];
+    if(keep > 0) {
+        memcpy(grown, *buffer, keep * sizeof(T));
+    }
+    delete[] *buffer;
+    *buffer = grown;
+    *capacity = new_capacity;
+}
+
+// Snapshots follow the storage of the grid at the bottom of an overlay chain.
+static const Grid& layout_grid(const Grid& grid)
+{
+    const Grid* layout = &grid;
+    while(layout->get_base() != 0) {
+        layout = layout->get_base();
+    }
+    return *layout;
+}
+
+// Clips `rect` to the grid; returns false when nothing is left.
+static bool clip_rect(const Grid& grid, GridRect* rect)
+{
+    if(rect->min_x < 0) { rect->min_x = 0; }
+    if(rect->min_y < 0) { rect->min_y = 0; }
+    if(rect->max_x >= grid.get_width()) { rect->max_x = grid.get_width() - 1; }
+    if(rect->max_y >= grid.get_height()) { rect->max_y = grid.get_height() - 1; }
+    return rect->min_x <= rect->max_x && rect->min_y <= rect->max_y;
+}
+
+RecordedQuery::RecordedQuery()
+    : snapshot(0)
+    , landmark_set(0)
+    , start(NoneLoc)
+    , goal(NoneLoc)
+    , engine(JPS_ENGINE_JPS)
+    , heuristic(0)
+    , clearance(1)
+    , epsilon(0.0)
+    , focal(false)
+    , max_cost(0.0)
+    , max_radius(0)
+    , max_expansions(0)
+    , path_length(0)
+    , status(JPS_STATUS_NO_PATH)
+    , expansions(0)
+    , cost(0.0)
+    , microseconds(0)
+{
+}
+
+void RecordedQuery::to_query(JpsQuery* out) const
+{
+    out->engine = (engine >= 0 && engine < JPS_ENGINE_COUNT) ? (JpsEngine)engine : JPS_ENGINE_JPS;
+    out->heuristic = query_log_heuristic(heuristic);
+    out->clearance = clearance;
+    out->epsilon = epsilon;
+    out->focal = focal;
+    out->landmarks = 0;
+    out->max_cost = max_cost;
+    out->max_radius = max_radius;
+    out->max_expansions = max_expansions;
+}
+
+QueryRecorder::QueryRecorder()
+    : file(0)
+    , failed(false)
+    , next_id(1)
+    , query_count(0)
+    , snapshot_cursor(0)
+    , set_cursor(0)
+    , runs(0)
+    , run_capacity(0)
+    , chunk_list(0)
+    , chunk_capacity(0)
+{
+    memset(snapshots, 0, sizeof(snapshots));
+    memset(sets, 0, sizeof(sets));
+}
+
+QueryRecorder::~QueryRecorder()
+{
+    close();
+    delete[] runs;
+    delete[] chunk_list;
+}
+
+bool QueryRecorder::open(const char* path)
+{
+    close();
+    file = fopen(path, "wb");
+    if(file == 0) {
+        return false;
+    }
+    failed = false;
+    next_id = 1;
+    query_count = 0;
+    memset(snapshots, 0, sizeof(snapshots));
+    memset(sets, 0, sizeof(sets));
+    write(&QUERY_LOG_MAGIC, sizeof(QUERY_LOG_MAGIC));
+    write(&QUERY_LOG_VERSION, sizeof(QUERY_LOG_VERSION));
+    return !failed;
+}
+
+bool QueryRecorder::close()
+{
+    if(file == 0) {
+        return true;
+    }
+    const unsigned char end = QUERY_LOG_END;
+    write(&end, sizeof(end));
+    if(fclose(file) != 0) {
+        failed = true;
+    }
+    file = 0;
+    return !failed;
+}
+
+void QueryRecorder::write(const void* data, size_t size)
+{
+    if(fwrite(data, 1, size, file) != size) {
+        failed = true;
+    }
+}
+
+void QueryRecorder::write_region(const Grid& grid, const GridRect& rect, unsigned char state)
+{
+    write(&rect, sizeof(rect));
+    write(&state, sizeof(state));
+    if(state != GRID_CHUNK_MIXED) {
+        return;
+    }
+
+    int count = 0;
+    unsigned int run = 0;
+    bool blocked = false;
+    int y;
+    for(y = rect.min_y; y <= rect.max_y; ++y) {
+        int x;
+        for(x = rect.min_x; x <= rect.max_x; ++x) {
+            if(grid.passable(make_location(x, y)) == blocked) {
+                reserve_buffer(&runs, &run_capacity, count + 1, count);
+                runs[count++] = run;
+                run = 0;
+                blocked = !blocked;
+            }
+            ++run;
+        }
+    }
+    reserve_buffer(&runs, &run_capacity, count + 1, count);
+    runs[count++] = run;
+    write(&count, sizeof(count));
+    write(runs, count * sizeof(unsigned int));
+}
+
+// One chunk of a chunked layout, clipped to the grid. Overrides of an
+// overlay make a chunk MIXED whatever its state in the base.
+unsigned char QueryRecorder::chunk_region(const Grid& grid, int chunk, GridRect* rect) const
+{
+    const Grid& layout = layout_grid(grid);
+    const int cx = chunk % layout.get_chunks_x();
+    const int cy = chunk / layout.get_chunks_x();
+    rect->min_x = cx << GRID_CHUNK_SHIFT;
+    rect->min_y = cy << GRID_CHUNK_SHIFT;
+    rect->max_x = rect->min_x + GRID_CHUNK_MASK;
+    rect->max_y = rect->min_y + GRID_CHUNK_MASK;
+    clip_rect(grid, rect);
+    unsigned char state = (unsigned char)layout.get_chunk_state(cx, cy);
+    if(state != GRID_CHUNK_MIXED && grid.is_overlay() && grid.overrides_in(*rect)) {
+        state = GRID_CHUNK_MIXED;
+    }
+    return state;
+}
+
+void QueryRecorder::write_grid(const Grid& grid, unsigned int id, unsigned int replaces)
+{
+    const Grid& layout = layout_grid(grid);
+    const unsigned char tag = QUERY_LOG_GRID;
+    const unsigned char chunked = layout.is_chunked() ? QUERY_LOG_CHUNKED : QUERY_LOG_FLAT;
+    const int width = grid.get_width();
+    const int height = grid.get_height();
+    write(&tag, sizeof(tag));
+    write(&id, sizeof(id));
+    write(&replaces, sizeof(replaces));
+    write(&width, sizeof(width));
+    write(&height, sizeof(height));
+    write(&chunked, sizeof(chunked));
+
+    if(!layout.is_chunked()) {
+        GridRect rect = {0, 0, width - 1, height - 1};
+        const int count = (width > 0 && height > 0) ? 1 : 0;
+        write(&count, sizeof(count));
+        if(count > 0) {
+            write_region(grid, rect, GRID_CHUNK_MIXED);
+        }
+        return;
+    }
+
+    // Unloaded chunks are the default and are left out.
+    const int chunk_count = layout.get_chunks_x() * layout.get_chunks_y();
+    GridRect rect;
+    int count = 0;
+    int chunk;
+    for(chunk = 0; chunk < chunk_count; ++chunk) {
+        if(chunk_region(grid, chunk, &rect) != GRID_CHUNK_UNLOADED) {
+            ++count;
+        }
+    }
+    write(&count, sizeof(count));
+    for(chunk = 0; chunk < chunk_count; ++chunk) {
+        const unsigned char state = chunk_region(grid, chunk, &rect);
+        if(state != GRID_CHUNK_UNLOADED) {
+            write_region(grid, rect, state);
+        }
+    }
+}
+
+// Writes what changed since `from` as an EDITS record. Returns false, and
+// writes nothing, when the grid's edit history does not reach back that far.
+bool QueryRecorder::write_edits(const Grid& grid, const Snapshot& from, unsigned int id)
+{
+    GridRect rects[GRID_EDIT_HISTORY * 4];
+    int rect_count = grid.edits_since(from.version, rects, GRID_EDIT_HISTORY * 4);
+    if(rect_count < 0) {
+        return false;
+    }
+
+    const unsigned char tag = QUERY_LOG_EDITS;
+    write(&tag, sizeof(tag));
+    write(&id, sizeof(id));
+    write(&from.id, sizeof(from.id));
+
+    int kept = 0;
+    int i;
+    for(i = 0; i < rect_count; ++i) {
+        if(clip_rect(grid, &rects[i])) {
+            rects[kept++] = rects[i];
+        }
+    }
+    rect_count = kept;
+
+    const Grid& layout = layout_grid(grid);
+    if(!layout.is_chunked()) {
+        write(&rect_count, sizeof(rect_count));
+        for(i = 0; i < rect_count; ++i) {
+            write_region(grid, rects[i], GRID_CHUNK_MIXED);
+        }
+        return true;
+    }
+
+    // Loads and unloads change a chunk's state, so whole chunks are resent.
+    const int chunks_x = layout.get_chunks_x();
+    int count = 0;
+    for(i = 0; i < rect_count; ++i) {
+        int cy;
+        for(cy = rects[i].min_y >> GRID_CHUNK_SHIFT; cy <= (rects[i].max_y >> GRID_CHUNK_SHIFT); ++cy) {
+            int cx;
+            for(cx = rects[i].min_x >> GRID_CHUNK_SHIFT; cx <= (rects[i].max_x >> GRID_CHUNK_SHIFT); ++cx) {
+                const int chunk = cy * chunks_x + cx;
+                int k = 0;
+                while(k < count && chunk_list[k] != chunk) {
+                    ++k;
+                }
+                if(k == count) {
+                    reserve_buffer(&chunk_list, &chunk_capacity, count + 1, count);
+                    chunk_list[count++] = chunk;
+                }
+            }
+        }
+    }
+    write(&count, sizeof(count));
+    for(i = 0; i < count; ++i) {
+        GridRect rect;
+        const unsigned char state = chunk_region(grid, chunk_list[i], &rect);
+        write_region(grid, rect, state);
+    }
+    return true;
+}
+
+unsigned int QueryRecorder::snapshot_id(const Grid& grid)
+{
+    const unsigned int version = grid.get_version();
+    Snapshot* latest = 0;
+    int i;
+    for(i = 0; i < CACHE_SIZE; ++i) {
+        if(snapshots[i].grid == &grid) {
+            latest = &snapshots[i];
+            break;
+        }
+    }
+    if(latest != 0 && latest->version == version) {
+        return latest->id;
+    }
+
+    const unsigned int id = next_id++;
+    if(latest == 0 || !write_edits(grid, *latest, id)) {
+        Snapshot* slot = latest;
+        if(slot == 0) {
+            slot = &snapshots[snapshot_cursor];
+            snapshot_cursor = (snapshot_cursor + 1) % CACHE_SIZE;
+        }
+        write_grid(grid, id, slot->id);
+        latest = slot;
+    }
+    latest->grid = &grid;
+    latest->version = version;
+    latest->id = id;
+    return id;
+}
+
+unsigned int QueryRecorder::landmark_set_id(unsigned int snapshot, const LandmarkTable& table)
+{
+    Location points[LANDMARK_MAX_COUNT];
+    const int count = table.get_count();
+    int i;
+    for(i = 0; i < count; ++i) {
+        points[i] = table.get_landmark(i);
+    }
+    for(i = 0; i < CACHE_SIZE; ++i) {
+        if(sets[i].snapshot == snapshot && sets[i].count == count
+            && memcmp(sets[i].points, points, count * sizeof(Location)) == 0) {
+            return sets[i].id;
+        }
+    }
+
+    LandmarkSet& set = sets[set_cursor];
+    set_cursor = (set_cursor + 1) % CACHE_SIZE;
+    set.snapshot = snapshot;
+    set.count = count;
+    memcpy(set.points, points, count * sizeof(Location));
+    set.id = next_id++;
+
+    const unsigned char tag = QUERY_LOG_LANDMARKS;
+    write(&tag, sizeof(tag));
+    write(&set.id, sizeof(set.id));
+    write(&set.snapshot, sizeof(set.snapshot));
+    write(&set.count, sizeof(set.count));
+    write(set.points, count * sizeof(Location));
+    return set.id;
+}
+
+void QueryRecorder::record(const Grid& grid, const Location& start, const Location& goal,
+    const JpsQuery& query, int path_length, const JpsStats& stats,
+    uint64_t microseconds)
+{
+    if(file == 0) {
+        return;
+    }
+    RecordedQuery recorded;
+    recorded.snapshot = snapshot_id(grid);
+    recorded.landmark_set = (query.landmarks != 0) ? landmark_set_id(recorded.snapshot, *query.landmarks) : 0;
+    recorded.start = start;
+    recorded.goal = goal;
+    recorded.engine = query.engine;
+    recorded.heuristic = query_log_heuristic_id(query.heuristic);
+    recorded.clearance = query.clearance;
+    recorded.epsilon = query.epsilon;
+    recorded.focal = query.focal;
+    recorded.max_cost = query.max_cost;
+    recorded.max_radius = query.max_radius;
+    recorded.max_expansions = query.max_expansions;
+    recorded.path_length = path_length;
+    recorded.status = stats.status;
+    recorded.expansions = stats.expansions;
+    recorded.cost = stats.cost;
+    recorded.microseconds = microseconds;
+
+    const unsigned char tag = QUERY_LOG_QUERY;
+    const unsigned char focal = recorded.focal ? 1 : 0;
+    write(&tag, sizeof(tag));
+    write(&recorded.snapshot, sizeof(recorded.snapshot));
+    write(&recorded.landmark_set, sizeof(recorded.landmark_set));
+    write(&recorded.start, sizeof(recorded.start));
+    write(&recorded.goal, sizeof(recorded.goal));
+    write(&recorded.engine, sizeof(recorded.engine));
+    write(&recorded.heuristic, sizeof(recorded.heuristic));
+    write(&recorded.clearance, sizeof(recorded.clearance));
+    write(&recorded.epsilon, sizeof(recorded.epsilon));
+    write(&focal, sizeof(focal));
+    write(&recorded.max_cost, sizeof(recorded.max_cost));
+    write(&recorded.max_radius, sizeof(recorded.max_radius));
+    write(&recorded.max_expansions, sizeof(recorded.max_expansions));
+    write(&recorded.path_length, sizeof(recorded.path_length));
+    write(&recorded.status, sizeof(recorded.status));
+    write(&recorded.expansions, sizeof(recorded.expansions));
+    write(&recorded.cost, sizeof(recorded.cost));
+    write(&recorded.microseconds, sizeof(recorded.microseconds));
+    ++query_count;
+}
+
+QueryLogReader::QueryLogReader()
+    : file(0)
+    , regions(0)
+    , region_count(0)
+    , region_capacity(0)
+    , runs(0)
+    , run_count(0)
+    , run_capacity(0)
+    , id(0)
+    , snapshot(0)
+    , replaced(0)
+    , width(0)
+    , height(0)
+    , chunked(false)
+    , landmark_count(0)
+{
+}
+
+QueryLogReader::~QueryLogReader()
+{
+    close();
+    delete[] regions;
+    delete[] runs;
+}
+
+bool QueryLogReader::open(const char* path)
+{
+    close();
+    file = fopen(path, "rb");
+    if(file == 0) {
+        return false;
+    }
+    unsigned int magic = 0;
+    unsigned int version = 0;
+    if(!read(&magic, sizeof(magic)) || !read(&version, sizeof(version))
+        || magic != QUERY_LOG_MAGIC || version != QUERY_LOG_VERSION) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void QueryLogReader::close()
+{
+    if(file != 0) {
+        fclose(file);
+        file = 0;
+    }
+}
+
+bool QueryLogReader::read(void* data, size_t size)
+{
+    return fread(data, 1, size, file) == size;
+}
+
+bool QueryLogReader::read_regions()
+{
+    int count;
+    if(!read(&count, sizeof(count)) || count < 0) {
+        return false;
+    }
+    reserve_buffer(&regions, &region_capacity, count, 0);
+    region_count = 0;
+    run_count = 0;
+    while(region_count < count) {
+        Region& region = regions[region_count];
+        const GridRect& rect = region.rect;
+        if(!read(&region.rect, sizeof(region.rect)) || !read(&region.state, sizeof(region.state))
+            || rect.min_x < 0 || rect.min_y < 0 || rect.max_x < rect.min_x || rect.max_y < rect.min_y
+            || region.state > GRID_CHUNK_MIXED) {
+            return false;
+        }
+        region.first_run = run_count;
+        region.run_count = 0;
+        if(region.state == GRID_CHUNK_MIXED) {
+            int runs_in_region;
+            if(!read(&runs_in_region, sizeof(runs_in_region)) || runs_in_region < 0) {
+                return false;
+            }
+            reserve_buffer(&runs, &run_capacity, run_count + runs_in_region, run_count);
+            if(!read(runs + run_count, runs_in_region * sizeof(unsigned int))) {
+                return false;
+            }
+            // The runs must cover the rectangle exactly.
+            uint64_t covered = 0;
+            int i;
+            for(i = 0; i < runs_in_region; ++i) {
+                covered += runs[run_count + i];
+            }
+            if(covered != (uint64_t)(rect.max_x - rect.min_x + 1) * (uint64_t)(rect.max_y - rect.min_y + 1)) {
+                return false;
+            }
+            region.run_count = runs_in_region;
+            run_count += runs_in_region;
+        }
+        ++region_count;
+    }
+    return true;
+}
+
+QueryLogRecord QueryLogReader::next()
+{
+    unsigned char tag;
+    if(file == 0 || !read(&tag, sizeof(tag))) {
+        return QUERY_LOG_ERROR;
+    }
+    switch(tag) {
+        case QUERY_LOG_END:
+            return QUERY_LOG_END;
+
+        case QUERY_LOG_GRID:
+        {
+            unsigned char layout;
+            if(!read(&id, sizeof(id)) || !read(&replaced, sizeof(replaced))
+                || !read(&width, sizeof(width)) || !read(&height, sizeof(height))
+                || !read(&layout, sizeof(layout)) || width < 0 || height < 0
+                || !read_regions()) {
+                return QUERY_LOG_ERROR;
+            }
+            chunked = layout == QUERY_LOG_CHUNKED;
+            snapshot = id;
+            return QUERY_LOG_GRID;
+        }
+
+        case QUERY_LOG_EDITS:
+            if(!read(&id, sizeof(id)) || !read(&snapshot, sizeof(snapshot)) || !read_regions()) {
+                return QUERY_LOG_ERROR;
+            }
+            return QUERY_LOG_EDITS;
+
+        case QUERY_LOG_LANDMARKS:
+            if(!read(&id, sizeof(id)) || !read(&snapshot, sizeof(snapshot))
+                || !read(&landmark_count, sizeof(landmark_count))
+                || landmark_count < 0 || landmark_count > LANDMARK_MAX_COUNT
+                || !read(landmarks, landmark_count * sizeof(Location))) {
+                return QUERY_LOG_ERROR;
+            }
+            return QUERY_LOG_LANDMARKS;
+
+        case QUERY_LOG_QUERY:
+        {
+            unsigned char focal;
+            if(!read(&query.snapshot, sizeof(query.snapshot))
+                || !read(&query.landmark_set, sizeof(query.landmark_set))
+                || !read(&query.start, sizeof(query.start))
+                || !read(&query.goal, sizeof(query.goal))
+                || !read(&query.engine, sizeof(query.engine))
+                || !read(&query.heuristic, sizeof(query.heuristic))
+                || !read(&query.clearance, sizeof(query.clearance))
+                || !read(&query.epsilon, sizeof(query.epsilon))
+                || !read(&focal, sizeof(focal))
+                || !read(&query.max_cost, sizeof(query.max_cost))
+                || !read(&query.max_radius, sizeof(query.max_radius))
+                || !read(&query.max_expansions, sizeof(query.max_expansions))
+                || !read(&query.path_length, sizeof(query.path_length))
+                || !read(&query.status, sizeof(query.status))
+                || !read(&query.expansions, sizeof(query.expansions))
+                || !read(&query.cost, sizeof(query.cost))
+                || !read(&query.microseconds, sizeof(query.microseconds))) {
+                return QUERY_LOG_ERROR;
+            }
+            query.focal = focal != 0;
+            return QUERY_LOG_QUERY;
+        }
+
+        default:
+            return QUERY_LOG_ERROR;
+    }
+}
+
+void QueryLogReader::apply_region(Grid* out, const Region& region) const
+{
+    const GridRect& rect = region.rect;
+    bool fresh = false;
+    if(out->is_chunked()) {
+        const int cx = rect.min_x >> GRID_CHUNK_SHIFT;
+        const int cy = rect.min_y >> GRID_CHUNK_SHIFT;
+        if(region.state == GRID_CHUNK_UNLOADED) {
+            out->unload_chunk(cx, cy);
+            return;
+        }
+        out->load_chunk(cx, cy, region.state == GRID_CHUNK_BLOCKED);
+        fresh = true;
+    }
+    else if(region.state != GRID_CHUNK_MIXED) {
+        // Uniform regions come from chunked layouts; unloaded reads as blocked.
+        int y;
+        for(y = rect.min_y; y <= rect.max_y; ++y) {
+            int x;
+            for(x = rect.min_x; x <= rect.max_x; ++x) {
+                out->set_blocked(make_location(x, y), region.state != GRID_CHUNK_OPEN);
+            }
+        }
+        return;
+    }
+    if(region.state != GRID_CHUNK_MIXED) {
+        return;
+    }
+
+    int x = rect.min_x;
+    int y = rect.min_y;
+    int i;
+    for(i = 0; i < region.run_count; ++i) {
+        const bool blocked = (i & 1) != 0;
+        unsigned int n;
+        for(n = runs[region.first_run + i]; n > 0; --n) {
+            // A freshly loaded chunk is already open.
+            if(blocked || !fresh) {
+                out->set_blocked(make_location(x, y), blocked);
+            }
+            if(++x > rect.max_x) {
+                x = rect.min_x;
+                ++y;
+            }
+        }
+    }
+}
+
+void QueryLogReader::build_grid(Grid* out) const
+{
+    if(chunked) {
+        out->reset_chunked(width, height);
+    }
+    else {
+        out->reset(width, height);
+    }
+    int i;
+    for(i = 0; i < region_count; ++i) {
+        apply_region(out, regions[i]);
+    }
+}
+
+void QueryLogReader::apply_edits(Grid* grid) const
+{
+    int i;
+    for(i = 0; i < region_count; ++i) {
+        apply_region(grid, regions[i]);
+    }
+}
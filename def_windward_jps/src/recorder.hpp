@@ -0,0 +1,182 @@
+#pragma once
+
+#include "jps.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Query logs: a header followed by tagged records, in native byte order.
+//
+//   GRID       snapshot id, id of the snapshot it replaces (0 for none),
+//              width, height, layout (0 flat, 1 chunked), region count,
+//              then the regions
+//   EDITS      snapshot id, id of the snapshot it updates, region count,
+//              then the regions that changed since that snapshot
+//   LANDMARKS  set id, snapshot id, count, then the landmark cells
+//   QUERY      a RecordedQuery
+//
+// A region is an inclusive cell rectangle and a GridChunkState. MIXED
+// regions are followed by a run count and run lengths of alternating open
+// and blocked cells in row-major order, starting with open. Chunked layouts
+// use one region per chunk and leave unloaded chunks out of GRID records.
+//
+// Each grid is written in full once; later versions are EDITS against the
+// previous one, taken from the grid's edit history. Once a snapshot has been
+// updated or replaced, no later record refers to it.
+enum QueryLogRecord
+{
+    QUERY_LOG_END = 0,
+    QUERY_LOG_GRID,
+    QUERY_LOG_LANDMARKS,
+    QUERY_LOG_QUERY,
+    QUERY_LOG_EDITS,
+    QUERY_LOG_ERROR
+};
+
+// Heuristics are stored by id: 0 octile, 1 manhattan, 2 euclidean.
+int query_log_heuristic_id(heuristic_fn* heuristic);
+heuristic_fn* query_log_heuristic(int id);
+
+struct RecordedQuery
+{
+    unsigned int snapshot;
+    // Landmark set used by the "alt" heuristic, 0 when none
+    unsigned int landmark_set;
+    Location start;
+    Location goal;
+    int engine;
+    int heuristic;
+    int clearance;
+    double epsilon;
+    bool focal;
+    double max_cost;
+    int max_radius;
+    int max_expansions;
+    // Result as returned by jps_find_path
+    int path_length;
+    int status;
+    int expansions;
+    double cost;
+    uint64_t microseconds;
+
+    RecordedQuery();
+    // Settings for jps_find_path, without the landmark tables.
+    void to_query(JpsQuery* out) const;
+};
+
+class QueryRecorder
+{
+private:
+    FILE* file;
+    bool failed;
+    unsigned int next_id;
+    int query_count;
+
+    // Latest snapshot of recently queried grids and recent landmark sets,
+    // replaced round-robin
+    struct Snapshot
+    {
+        const Grid* grid;
+        unsigned int version;
+        unsigned int id;
+    };
+    struct LandmarkSet
+    {
+        unsigned int snapshot;
+        int count;
+        Location points[LANDMARK_MAX_COUNT];
+        unsigned int id;
+    };
+    enum { CACHE_SIZE = 8 };
+    Snapshot snapshots[CACHE_SIZE];
+    int snapshot_cursor;
+    LandmarkSet sets[CACHE_SIZE];
+    int set_cursor;
+
+    // Scratch for run lengths and the chunks touched by an edit
+    unsigned int* runs;
+    int run_capacity;
+    int* chunk_list;
+    int chunk_capacity;
+
+    void write(const void* data, size_t size);
+    void write_region(const Grid& grid, const GridRect& rect, unsigned char state);
+    unsigned char chunk_region(const Grid& grid, int chunk, GridRect* rect) const;
+    void write_grid(const Grid& grid, unsigned int id, unsigned int replaces);
+    bool write_edits(const Grid& grid, const Snapshot& from, unsigned int id);
+    unsigned int snapshot_id(const Grid& grid);
+    unsigned int landmark_set_id(unsigned int snapshot, const LandmarkTable& table);
+
+    // Disable copying
+    QueryRecorder(const QueryRecorder&);
+    QueryRecorder& operator=(const QueryRecorder&);
+
+public:
+    QueryRecorder();
+    ~QueryRecorder();
+
+    // Starts a new log, replacing any file at `path`.
+    bool open(const char* path);
+    // Returns false when any write failed.
+    bool close();
+    bool is_open() const { return file != 0; }
+    int get_query_count() const { return query_count; }
+
+    void record(const Grid& grid, const Location& start, const Location& goal,
+        const JpsQuery& query, int path_length, const JpsStats& stats,
+        uint64_t microseconds);
+};
+
+class QueryLogReader
+{
+private:
+    FILE* file;
+
+    // Regions of the last GRID or EDITS record; runs index into `runs`.
+    struct Region
+    {
+        GridRect rect;
+        unsigned char state;
+        int first_run;
+        int run_count;
+    };
+    Region* regions;
+    int region_count;
+    int region_capacity;
+    unsigned int* runs;
+    int run_count;
+    int run_capacity;
+
+    bool read(void* data, size_t size);
+    bool read_regions();
+    void apply_region(Grid* out, const Region& region) const;
+
+    // Disable copying
+    QueryLogReader(const QueryLogReader&);
+    QueryLogReader& operator=(const QueryLogReader&);
+
+public:
+    // Payload of the last record read. For EDITS, `snapshot` is the snapshot
+    // being updated; for GRID, `replaced` is the one it supersedes, or 0.
+    unsigned int id;
+    unsigned int snapshot;
+    unsigned int replaced;
+    int width;
+    int height;
+    bool chunked;
+    int landmark_count;
+    Location landmarks[LANDMARK_MAX_COUNT];
+    RecordedQuery query;
+
+    QueryLogReader();
+    ~QueryLogReader();
+
+    bool open(const char* path);
+    void close();
+    // Reads the next record and returns its type.
+    QueryLogRecord next();
+    // Rebuilds the walls of the last GRID record, chunked when it was.
+    void build_grid(Grid* out) const;
+    // Applies the last EDITS record to the grid built for its snapshot.
+    void apply_edits(Grid* grid) const;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "grid.hpp"
@@ -37,4 +38,7 @@ namespace Tool
     {
         return octile_int(a, b) / 1000.0;
     }
+
+    // Monotonic clock for timing queries; only differences are meaningful.
+    uint64_t now_microseconds();
 }
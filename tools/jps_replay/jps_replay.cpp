@@ -0,0 +1,349 @@
+// jps_replay.cpp
+// Re-runs a query log written by def_windward_jps.start_recording against the
+// current search code and reports timing deltas and changed results.
+//
+// Build from the repository root (one command):
+//   g++ -std=c++98 -O2 -I def_windward_jps/src -o jps_replay
+//       tools/jps_replay/jps_replay.cpp def_windward_jps/src/grid.cpp
+//       def_windward_jps/src/jps.cpp def_windward_jps/src/tools.cpp
+//       def_windward_jps/src/overlay.cpp def_windward_jps/src/landmarks.cpp
+//       def_windward_jps/src/recorder.cpp
+//
+// Usage: jps_replay [-r repeats] [-v] [-b] [-t top] log.jpsr
+//   -r  run every query this many times and keep the fastest (default 5)
+//   -v  print every query, not only changed ones
+//   -b  check epsilon queries against an exact search: the cost must be
+//       within (1 + epsilon) of optimal and the reported suboptimality at
+//       least the true ratio
+//   -t  list this many of the largest slowdowns (default 10)
+//
+// Recorded times come from the device that wrote the log; compare them to a
+// replay on the same machine, or replay one log with two builds.
+
+#include "jps.hpp"
+#include "landmarks.hpp"
+#include "recorder.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+// Current version of one recorded grid; EDITS records move it forward.
+struct ReplaySnapshot
+{
+    unsigned int id;
+    Grid* grid;
+};
+
+struct ReplayLandmarks
+{
+    unsigned int id;
+    unsigned int snapshot;
+    LandmarkTable* table;
+};
+
+struct ReplayResult
+{
+    int index;
+    double recorded;
+    double replayed;
+};
+
+static bool SlowerFirst(const ReplayResult& a, const ReplayResult& b)
+{
+    return (a.replayed - a.recorded) > (b.replayed - b.recorded);
+}
+
+static const char* STATUS_NAMES[] = {"found", "no_path", "cost_limit", "radius_limit", "expansion_limit"};
+
+static const char* StatusName(int status)
+{
+    if(status < 0 || status > JPS_STATUS_EXPANSION_LIMIT) {
+        return "?";
+    }
+    return STATUS_NAMES[status];
+}
+
+static ReplaySnapshot* FindSnapshot(std::vector<ReplaySnapshot>& snapshots, unsigned int id)
+{
+    size_t i;
+    for(i = 0; i < snapshots.size(); ++i) {
+        if(snapshots[i].id == id) {
+            return &snapshots[i];
+        }
+    }
+    return 0;
+}
+
+static Grid* FindGrid(std::vector<ReplaySnapshot>& snapshots, unsigned int id)
+{
+    ReplaySnapshot* snapshot = FindSnapshot(snapshots, id);
+    return snapshot != 0 ? snapshot->grid : 0;
+}
+
+// Landmark sets are computed for one snapshot and go with it.
+static void ReleaseLandmarks(std::vector<ReplayLandmarks>& sets, unsigned int snapshot)
+{
+    size_t i = 0;
+    while(i < sets.size()) {
+        if(sets[i].snapshot == snapshot) {
+            delete sets[i].table;
+            sets.erase(sets.begin() + i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+static void ReleaseSnapshot(std::vector<ReplaySnapshot>& snapshots, std::vector<ReplayLandmarks>& sets, unsigned int id)
+{
+    size_t i;
+    for(i = 0; i < snapshots.size(); ++i) {
+        if(snapshots[i].id == id) {
+            delete snapshots[i].grid;
+            snapshots.erase(snapshots.begin() + i);
+            break;
+        }
+    }
+    ReleaseLandmarks(sets, id);
+}
+
+static LandmarkTable* FindLandmarks(const std::vector<ReplayLandmarks>& sets, unsigned int id)
+{
+    size_t i;
+    for(i = 0; i < sets.size(); ++i) {
+        if(sets[i].id == id) {
+            return sets[i].table;
+        }
+    }
+    return 0;
+}
+
+static void Usage()
+{
+    fprintf(stderr, "usage: jps_replay [-r repeats] [-v] [-b] [-t top] log.jpsr\n");
+}
+
+int main(int argc, char** argv)
+{
+    int repeats = 5;
+    int top = 10;
+    bool verbose = false;
+    bool check_bounds = false;
+    const char* path = 0;
+    int i;
+    for(i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            repeats = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            top = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if(strcmp(argv[i], "-b") == 0) {
+            check_bounds = true;
+        } else if(argv[i][0] != '-' && path == 0) {
+            path = argv[i];
+        } else {
+            Usage();
+            return 2;
+        }
+    }
+    if(path == 0 || repeats < 1) {
+        Usage();
+        return 2;
+    }
+
+    QueryLogReader reader;
+    if(!reader.open(path)) {
+        fprintf(stderr, "%s: not a query log\n", path);
+        return 2;
+    }
+
+    std::vector<ReplaySnapshot> snapshots;
+    std::vector<ReplayLandmarks> landmark_sets;
+    std::vector<ReplayResult> results;
+    JpsPath replay_path;
+    int query_count = 0;
+    int grid_records = 0;
+    int edit_records = 0;
+    int changed = 0;
+    int bound_failures = 0;
+    int skipped = 0;
+    double recorded_total = 0.0;
+    double replayed_total = 0.0;
+    bool done = false;
+
+    while(!done) {
+        switch(reader.next()) {
+            case QUERY_LOG_END:
+                done = true;
+                break;
+
+            case QUERY_LOG_ERROR:
+                fprintf(stderr, "%s: truncated or corrupt log, stopping after %d queries\n", path, query_count);
+                done = true;
+                break;
+
+            case QUERY_LOG_GRID:
+            {
+                if(reader.replaced != 0) {
+                    ReleaseSnapshot(snapshots, landmark_sets, reader.replaced);
+                }
+                ReplaySnapshot snapshot;
+                snapshot.id = reader.id;
+                snapshot.grid = new Grid();
+                reader.build_grid(snapshot.grid);
+                snapshots.push_back(snapshot);
+                ++grid_records;
+                break;
+            }
+
+            case QUERY_LOG_EDITS:
+            {
+                ReplaySnapshot* snapshot = FindSnapshot(snapshots, reader.snapshot);
+                if(snapshot == 0) {
+                    break;
+                }
+                reader.apply_edits(snapshot->grid);
+                ReleaseLandmarks(landmark_sets, snapshot->id);
+                snapshot->id = reader.id;
+                ++edit_records;
+                break;
+            }
+
+            case QUERY_LOG_LANDMARKS:
+            {
+                const Grid* grid = FindGrid(snapshots, reader.snapshot);
+                if(grid == 0) {
+                    break;
+                }
+                ReplayLandmarks set;
+                set.id = reader.id;
+                set.snapshot = reader.snapshot;
+                set.table = new LandmarkTable();
+                const int count = set.table->prepare_at(*grid, reader.landmarks, reader.landmark_count);
+                int landmark;
+                for(landmark = 0; landmark < count; ++landmark) {
+                    set.table->compute(*grid, landmark);
+                }
+                landmark_sets.push_back(set);
+                break;
+            }
+
+            case QUERY_LOG_QUERY:
+            {
+                const RecordedQuery& recorded = reader.query;
+                const int index = query_count++;
+                Grid* grid = FindGrid(snapshots, recorded.snapshot);
+                JpsQuery query;
+                recorded.to_query(&query);
+                if(recorded.landmark_set != 0) {
+                    query.landmarks = FindLandmarks(landmark_sets, recorded.landmark_set);
+                }
+                if(grid == 0 || (recorded.landmark_set != 0 && query.landmarks == 0)) {
+                    printf("#%d skipped: missing snapshot\n", index);
+                    ++skipped;
+                    break;
+                }
+                if(query.clearance > 1) {
+                    grid->ensure_clearance();
+                }
+
+                // Keep the fastest of the repeats, as the recorded time is a
+                // single warm run.
+                JpsStats stats;
+                int path_length = 0;
+                uint64_t best = 0;
+                int repeat;
+                for(repeat = 0; repeat < repeats; ++repeat) {
+                    const uint64_t started = Tool::now_microseconds();
+                    path_length = jps_find_path(*grid, recorded.start, recorded.goal, query, &replay_path, &stats);
+                    const uint64_t elapsed = Tool::now_microseconds() - started;
+                    if(repeat == 0 || elapsed < best) {
+                        best = elapsed;
+                    }
+                }
+
+                ReplayResult result;
+                result.index = index;
+                result.recorded = (double)recorded.microseconds;
+                result.replayed = (double)best;
+                results.push_back(result);
+                recorded_total += result.recorded;
+                replayed_total += result.replayed;
+
+                if(check_bounds && query.epsilon > 0.0 && stats.status == JPS_STATUS_FOUND) {
+                    JpsQuery exact = query;
+                    exact.epsilon = 0.0;
+                    exact.focal = false;
+                    JpsStats exact_stats;
+                    JpsPath exact_path;
+                    if(jps_find_path(*grid, recorded.start, recorded.goal, exact, &exact_path, &exact_stats) > 0
+                        && exact_stats.cost > 0.0) {
+                        const double ratio = stats.cost / exact_stats.cost;
+                        if(ratio > 1.0 + query.epsilon + 1e-9 || stats.suboptimality < ratio - 1e-9) {
+                            printf("#%d BOUND epsilon %.3f%s: cost %.3f, optimal %.3f, ratio %.4f, reported %.4f\n",
+                                index, query.epsilon, query.focal ? " focal" : "", stats.cost, exact_stats.cost,
+                                ratio, stats.suboptimality);
+                            ++bound_failures;
+                        }
+                    }
+                }
+
+                const bool differs = path_length != recorded.path_length
+                    || (int)stats.status != recorded.status
+                    || fabs(stats.cost - recorded.cost) > 1e-6;
+                if(differs) {
+                    ++changed;
+                }
+                if(differs || verbose) {
+                    printf("#%d (%d,%d)->(%d,%d) %s%.0fus -> %.0fus",
+                        index, recorded.start.x, recorded.start.y, recorded.goal.x, recorded.goal.y,
+                        differs ? "CHANGED " : "", result.recorded, result.replayed);
+                    printf(" length %d -> %d, cost %.3f -> %.3f, status %s -> %s, expansions %d -> %d\n",
+                        recorded.path_length, path_length, recorded.cost, stats.cost,
+                        StatusName(recorded.status), StatusName(stats.status),
+                        recorded.expansions, stats.expansions);
+                }
+                break;
+            }
+
+            default:
+                done = true;
+                break;
+        }
+    }
+
+    std::sort(results.begin(), results.end(), SlowerFirst);
+    for(i = 0; i < top && i < (int)results.size() && results[i].replayed > results[i].recorded; ++i) {
+        if(i == 0) {
+            printf("\nlargest slowdowns:\n");
+        }
+        printf("  #%d %.0fus -> %.0fus (%+.0fus)\n", results[i].index,
+            results[i].recorded, results[i].replayed, results[i].replayed - results[i].recorded);
+    }
+
+    printf("\n%d queries, %d grid snapshots, %d edit records, %d changed, %d skipped\n",
+        query_count, grid_records, edit_records, changed, skipped);
+    if(check_bounds) {
+        printf("%d epsilon queries outside their bound\n", bound_failures);
+    }
+    if(recorded_total > 0.0) {
+        printf("total %.0fus recorded, %.0fus replayed (%+.1f%%)\n",
+            recorded_total, replayed_total, (replayed_total / recorded_total - 1.0) * 100.0);
+    }
+
+    size_t k;
+    for(k = 0; k < snapshots.size(); ++k) {
+        delete snapshots[k].grid;
+    }
+    for(k = 0; k < landmark_sets.size(); ++k) {
+        delete landmark_sets[k].table;
+    }
+    jps_shutdown();
+    return (changed > 0 || bound_failures > 0) ? 1 : 0;
+}